@@ -1,4 +1,5 @@
 #include "args.h"
+#include "config.h"
 
 static char doc[] =
 	"DelayDaemon 1.1 -- A GNU/Linux tool to add (varying) latency to input devices\n"
@@ -10,61 +11,199 @@ const char *argp_program_version =
 static char args_doc[] =
 	"--input <FILE> --min_key_delay <NUM> --max_key_delay <NUM>";
 
+// options without a short form
+enum
+{
+    OPTION_MEAN2 = 256,
+    OPTION_STD2,
+    OPTION_WEIGHT,
+    OPTION_PRIORITY,
+    OPTION_CPU,
+    OPTION_LOG_CPU,
+    OPTION_LOCK_MEMORY,
+    OPTION_SHM,
+    OPTION_SOCKET,
+    OPTION_PROFILE,
+    OPTION_POLICIES
+};
+
 static struct argp_option options[] =
 {
+	{"config", 'c', "FILE", 0, "read settings from FILE, it is reloaded whenever it changes"},
 	{"input", 'i', "FILE", 0, "/dev/input/eventX"},
-	{"min_key_delay", '0', "NUM", 0, "Minimum delay for keys/clicks"},
-	{"max_key_delay", '1', "NUM", 0, "Maximum delay for keys/clicks"},
-	{"min_move_delay", '2', "NUM", 0, "Minimum delay for mouse movement"},
-	{"max_move_delay", '3', "NUM", 0, "Maximum delay for mouse movement"},
-	{"distribution", 'd', "STRING", OPTION_ARG_OPTIONAL, "[linear] (default) or [normal] distributed random values"},
+	{"min_key_delay", '0', "NUM", 0, "Minimum delay for keys/clicks in milliseconds (fractions allowed)"},
+	{"max_key_delay", '1', "NUM", 0, "Maximum delay for keys/clicks in milliseconds (fractions allowed)"},
+	{"min_move_delay", '2', "NUM", 0, "Minimum delay for mouse movement in milliseconds (fractions allowed)"},
+	{"max_move_delay", '3', "NUM", 0, "Maximum delay for mouse movement in milliseconds (fractions allowed)"},
+	{"distribution", 'd', "STRING", OPTION_ARG_OPTIONAL, "[linear] (default), [normal], [lognormal], [exponential], [gamma], [pareto] or [bimodal] distributed random values, [file:PATH] to draw delays from a histogram, or [trace:PATH[,PATH]] to replay recorded delays"},
 	{"mean", 'm', "NUM", OPTION_ARG_OPTIONAL, "target mean value for normal distribution"},
+	{"mean2", OPTION_MEAN2, "NUM", 0, "mean value of the second mode of a bimodal distribution"},
+	{"std2", OPTION_STD2, "NUM", 0, "standard deviation of the second mode of a bimodal distribution"},
+	{"weight", OPTION_WEIGHT, "NUM", 0, "share of the first mode of a bimodal distribution (default 0.5)"},
+	{"seed", 'r', "NUM", 0, "seed for the random delays (default: random)"},
 	{"std", 's', "NUM", OPTION_ARG_OPTIONAL, "target standard distribution for normal distribution"},
 	{"fifo", 'f', "FILE", OPTION_ARG_OPTIONAL, "path to the fifo file"},
+	{"policies", OPTION_POLICIES, "FILE", 0, "delays for single event codes and types as described in FILE"},
+	{"profile", OPTION_PROFILE, "FILE", 0, "change the delays over time as described in FILE"},
+	{"socket", OPTION_SOCKET, "FILE", 0, "path to the control socket"},
+	{"shm", OPTION_SHM, "NAME", 0, "share the delay configuration through the POSIX shared memory object NAME (e.g. /delaydaemon)"},
+	{"log_segment", 'L', "NUM", 0, "size of event log segment files in MiB (default 64)"},
+	{"pool_size", 'p', "NUM", 0, "maximum number of pending events (default 4096)"},
+	{"pool_policy", 'P', "STRING", 0, "what to do with new events if the maximum is reached: [block] (default), [drop] or [bypass] the delay"},
+	{"read_batch", 'b', "NUM", 0, "read up to NUM events per read() from the device (default 0: read through libevdev)"},
+	{"tick", 't', "NUM", 0, "timer granularity in microseconds (default 10)"},
+	{"spin", 'S', "NUM", OPTION_ARG_OPTIONAL, "wake up NUM microseconds before each deadline and busy-wait for it (default: tuned to the observed wakeup latency)"},
+	{"priority", OPTION_PRIORITY, "NUM", 0, "run the event loop with SCHED_FIFO at priority NUM (1-99)"},
+	{"cpu", OPTION_CPU, "NUM", 0, "pin the event loop to CPU NUM"},
+	{"log_cpu", OPTION_LOG_CPU, "NUM", 0, "pin the event log writer to CPU NUM"},
+	{"lock_memory", OPTION_LOCK_MEMORY, NULL, 0, "lock all memory of the process into RAM"},
 	{"verbose", 'v', NULL, OPTION_ARG_OPTIONAL, "turn on debug prints"},
 	{0}
 };
 
-static error_t parse_opt(int key, char *arg, struct argp_state *state)
+// optional arguments of short options are passed with their '=' (e.g. -d=normal), long options without it
+static char* optional_arg(char *arg)
 {
-	struct arguments *args = state->input;
+    if(arg == NULL) return "";
+    if(arg[0] == '=') return arg + 1;
+    return arg;
+}
 
+// store the value of an option, options from the command line and the configuration file both end up here
+static void set_arg(struct arguments *args, int key, char *arg)
+{
 	switch (key) {
 	case 'i':
         args->device_file = arg;
         break;
     case '0':
-        args->min_key_delay = strtol(arg, NULL, 10);
+        args->min_key_delay = strtod(arg, NULL);
         break;
     case '1':
-        args->max_key_delay = strtol(arg, NULL, 10);
+        args->max_key_delay = strtod(arg, NULL);
         break;
     case '2':
-        args->min_move_delay = strtol(arg, NULL, 10);
+        args->min_move_delay = strtod(arg, NULL);
         break;
     case '3':
-        args->max_move_delay = strtol(arg, NULL, 10);
+        args->max_move_delay = strtod(arg, NULL);
         break;
     case 'd':
-        args->distribution = arg + 1;   // skip the '=' character
+        args->distribution = optional_arg(arg);
         break;
     case 'm':
-        args->mean = strtol(arg, NULL, 10);
+        args->mean = strtod(optional_arg(arg), NULL);
+        break;
+    case 'r':
+        args->seed = strtoul(arg, NULL, 10);
+        args->seed_set = 1;
         break;
     case 's':
-        args->std = strtol(arg, NULL, 10);
+        args->std = strtod(optional_arg(arg), NULL);
         break;
     case 'f':
-        args->fifo_path = arg +1;
+        args->fifo_path = optional_arg(arg);
+        break;
+    case 'L':
+        args->log_segment = strtol(arg, NULL, 10);
+        break;
+    case 'p':
+        args->pool_size = strtol(arg, NULL, 10);
+        break;
+    case 'P':
+        args->pool_policy = arg;
+        break;
+    case 'S':
+        args->spin = strtol(optional_arg(arg), NULL, 10);
+        break;
+    case 'b':
+        args->read_batch = strtol(arg, NULL, 10);
+        break;
+    case 't':
+        args->tick = strtol(arg, NULL, 10);
+        break;
+    case OPTION_MEAN2:
+        args->mean2 = strtod(arg, NULL);
+        break;
+    case OPTION_STD2:
+        args->std2 = strtod(arg, NULL);
+        break;
+    case OPTION_WEIGHT:
+        args->weight = strtod(arg, NULL);
+        break;
+    case OPTION_PRIORITY:
+        args->priority = strtol(arg, NULL, 10);
+        break;
+    case OPTION_CPU:
+        args->cpu = strtol(arg, NULL, 10);
+        break;
+    case OPTION_LOG_CPU:
+        args->log_cpu = strtol(arg, NULL, 10);
+        break;
+    case OPTION_LOCK_MEMORY:
+        args->lock_memory = 1;
+        break;
+    case OPTION_POLICIES:
+        args->policy_path = arg;
+        break;
+    case OPTION_PROFILE:
+        args->profile_path = arg;
+        break;
+    case OPTION_SOCKET:
+        args->socket_path = arg;
+        break;
+    case OPTION_SHM:
+        args->shm_name = arg;
         break;
     case 'v':
         args->verbose = 1;
         break;
+    }
+}
+
+// set an option by its long name, used for the settings of the configuration file
+// options without an argument are switched on by any value except 0, no, false and off
+// returns 0 if there is no option with this name
+int set_option(struct arguments *args, const char *name, char *value)
+{
+    for(struct argp_option *option = options; option->name; option++)
+    {
+        if(strcmp(option->name, name) != 0) continue;
+
+        if(option->arg == NULL)
+        {
+            if(strcmp(value, "0") == 0 || strcmp(value, "no") == 0 || strcmp(value, "false") == 0 || strcmp(value, "off") == 0) return 1;
+            value = NULL;
+        }
+
+        set_arg(args, option->key, value);
+        return 1;
+    }
+
+    return 0;
+}
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct arguments *args = state->input;
+
+	switch (key) {
+    case 'c':
+        // settings are applied in place, options given after --config override the file
+        args->config_path = arg;
+        if(!load_config(arg, args)) return EINVAL;
+        break;
 	case ARGP_KEY_END:
 
 		/* Check if file is specified. */
 		if (args->device_file == NULL)
         {
+            // a reload must not exit the running daemon
+            if(state->flags & ARGP_NO_EXIT)
+            {
+                printf("No input device given\n");
+                return EINVAL;
+            }
 			argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
 		}
 
@@ -73,11 +212,18 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
             args->max_key_delay = args->min_key_delay;
         }
         // set default values if none specified
-        if(strcmp(args->distribution, "normal") == 0)
+        if(strcmp(args->distribution, "") != 0
+        && strcmp(args->distribution, "linear") != 0
+        && strncmp(args->distribution, "file:", 5) != 0
+        && strncmp(args->distribution, "trace:", 6) != 0)
         {
             if(args->mean == 0) args->mean = (args->max_key_delay + args->min_key_delay) / 2;
             if(args->std == 0) args->std = args->mean / 10;
-
+            if(args->mean2 == 0) args->mean2 = args->mean;
+            if(args->std2 == 0) args->std2 = args->std;
+        }
+        if(strcmp(args->distribution, "normal") == 0)
+        {
             if(args->mean > args->max_key_delay
             || args->mean < args->min_key_delay
             ||(args->mean > args->max_move_delay && args->max_move_delay > 0)   // since move delay is optional and can be 0
@@ -88,14 +234,18 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
             }
         }
 		break;
+    default:
+        set_arg(args, key, arg);
+        break;
 	}
 
 	return 0;
 }
 
-error_t parse_args(int argc, char **argv, struct arguments *args)
+// flags are passed on to argp_parse, reloads use ARGP_NO_EXIT | ARGP_SILENT so a broken configuration can't exit the daemon
+error_t parse_args(int argc, char **argv, struct arguments *args, unsigned flags)
 {
 	struct argp argp = {options, parse_opt, args_doc, doc};
 
-	return argp_parse(&argp, argc, argv, 0, 0, args);
+	return argp_parse(&argp, argc, argv, flags, 0, args);
 }
\ No newline at end of file
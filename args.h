@@ -7,18 +7,40 @@
 
 struct arguments
 {
+    char* config_path;
+    char* config_data;          // contents of the configuration file, string settings point into it
     char* device_file;
-    int min_key_delay;
-    int max_key_delay;
-    int min_move_delay;
-    int max_move_delay;
+    double min_key_delay;
+    double max_key_delay;
+    double min_move_delay;
+    double max_move_delay;
     char* distribution;
     float mean;
     float std;
+    float mean2;
+    float std2;
+    float weight;
     char* fifo_path;
+    char* shm_name;
+    char* socket_path;
+    char* profile_path;
+    char* policy_path;
+    int tick;
+    int spin;
+    int read_batch;
+    int pool_size;
+    char* pool_policy;
+    int log_segment;
+    int priority;
+    int cpu;
+    int log_cpu;
+    int lock_memory;
+    unsigned long seed;
+    int seed_set;
     int verbose;
 };
 
-error_t parse_args(int argc, char **argv, struct arguments *arg);
+error_t parse_args(int argc, char **argv, struct arguments *arg, unsigned flags);
+int set_option(struct arguments *args, const char *name, char *value);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "config.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// remove whitespace (and a pair of quotes) around a value in place
+static char* trim(char *text)
+{
+    while(isspace((unsigned char)*text)) text++;
+
+    char *end = text + strlen(text);
+    while(end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    if(end - text >= 2 && text[0] == '"' && end[-1] == '"')
+    {
+        end[-1] = '\0';
+        text++;
+    }
+
+    return text;
+}
+
+// read all settings of a configuration file into args
+// the file is kept in memory (args->config_data) as string settings point into it
+// empty lines and lines starting with '#' or ';' are ignored
+// returns 0 if the file can't be read or contains an unknown setting
+int load_config(const char *path, struct arguments *args)
+{
+    FILE *file = fopen(path, "r");
+    if(file == NULL)
+    {
+        printf("Failed to open configuration file %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char *data = malloc(size + 1);
+    size = fread(data, 1, size, file);
+    data[size] = '\0';
+    fclose(file);
+
+    args->config_data = data;
+
+    // lines are split by hand, strtok would skip empty lines and throw off the line numbers
+    int number = 0;
+    char *section = "";
+    for(char *line = data, *next; line; line = next)
+    {
+        next = strchr(line, '\n');
+        if(next) *next++ = '\0';
+
+        number++;
+        line = trim(line);
+
+        if(line[0] == '\0' || line[0] == '#' || line[0] == ';') continue;
+
+        if(line[0] == '[')
+        {
+            char *end = strchr(line, ']');
+            if(end) *end = '\0';
+            section = line + 1;
+            continue;
+        }
+
+        char *value = strchr(line, '=');
+        if(value == NULL)
+        {
+            printf("%s:%d: expected name = value\n", path, number);
+            return 0;
+        }
+        *value++ = '\0';
+
+        char *name = trim(line);
+        if(!set_option(args, name, trim(value)))
+        {
+            printf("%s:%d: unknown setting %s%s%s\n", path, number, section, section[0] ? "." : "", name);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// returns an inotify fd reporting changes of the configuration file, -1 on failure
+int watch_config(const char *path)
+{
+    char directory[4096];
+    const char *slash = strrchr(path, '/');
+
+    if(slash == NULL) strcpy(directory, ".");
+    else if(slash == path) strcpy(directory, "/");
+    else snprintf(directory, sizeof(directory), "%.*s", (int)(slash - path), path);
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0) return -1;
+
+    if(inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// read all pending notifications, returns 1 if any of them was about the configuration file
+int config_changed(int fd, const char *path)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    int changed = 0;
+    ssize_t length;
+
+    while((length = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for(char *p = buffer; p < buffer + length; )
+        {
+            struct inotify_event *event = (struct inotify_event*)p;
+            if(event->len > 0 && strcmp(event->name, name) == 0) changed = 1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}
@@ -0,0 +1,14 @@
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include "args.h"
+
+// INI-style configuration file, every setting has the name of a long command line option
+// sections ([device], [delay], [distribution], [control], [logging], [scheduling]) only group them
+int load_config(const char *path, struct arguments *args);
+
+// the directory of the file is watched, as editors often replace a file instead of writing to it
+int watch_config(const char *path);
+int config_changed(int fd, const char *path);
+
+#endif
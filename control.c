@@ -0,0 +1,84 @@
+#include "control.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// create the shared memory object and publish the initial configuration
+// returns NULL if the object can't be created or mapped
+control_block* open_control_block(const char *name, control_config *initial)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0) return NULL;
+
+    if(ftruncate(fd, sizeof(control_block)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    control_block *block = mmap(NULL, sizeof(control_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(block == MAP_FAILED) return NULL;
+
+    block->version = CONTROL_VERSION;
+    block->config_size = sizeof(control_config);
+    block->lock = 0;
+    block->slots[0] = *initial;
+    __atomic_store_n(&block->sequence, 0, __ATOMIC_RELEASE);
+
+    // the magic is written last, so controllers can wait for it before they use the block
+    memcpy(block->magic, CONTROL_MAGIC, 4);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return block;
+}
+
+void close_control_block(control_block *block, const char *name)
+{
+    if(block == NULL) return;
+
+    munmap(block, sizeof(control_block));
+    shm_unlink(name);
+}
+
+// write a new configuration to the inactive slot and make it the active one
+// the lock is only tried CONTROL_LOCK_ATTEMPTS times, a controller that died while holding it must not hang the caller
+// returns 0 if the lock couldn't be taken, nothing is published then
+int publish_config(control_block *block, control_config *config)
+{
+    int attempts = 0;
+    uint32_t unlocked = 0;
+
+    while(!__atomic_compare_exchange_n(&block->lock, &unlocked, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        if(++attempts == CONTROL_LOCK_ATTEMPTS) return 0;
+        unlocked = 0;
+    }
+
+    uint64_t sequence = __atomic_load_n(&block->sequence, __ATOMIC_RELAXED);
+    block->slots[(sequence + 1) & 1] = *config;
+    __atomic_store_n(&block->sequence, sequence + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&block->lock, 0, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// copy the active configuration, returns its sequence number
+// the copy is retried if a writer published a new configuration meanwhile,
+// as the next writer might already be overwriting the slot that was copied
+uint64_t read_config(control_block *block, control_config *config)
+{
+    uint64_t before, after;
+
+    do
+    {
+        before = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+        memcpy(config, &block->slots[before & 1], sizeof(control_config));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&block->sequence, __ATOMIC_RELAXED);
+    }
+    while(before != after);
+
+    return before;
+}
@@ -0,0 +1,55 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdint.h>
+
+// delay configuration shared with other processes through POSIX shared memory
+// the block holds two configuration slots, sequence & 1 is the one currently in use
+// a writer fills the other slot and then publishes it by incrementing sequence with a single store,
+// readers copy the active slot and retry if sequence changed meanwhile, nobody ever waits for a lock
+// writers (the daemon itself when it gets a FIFO message, external controllers) take the lock field
+// with a compare-and-swap from 0 to 1 before touching the inactive slot and reset it afterwards,
+// the daemon gives up after CONTROL_LOCK_ATTEMPTS tries and publishes again later
+// all fields are stored in native byte order
+#define CONTROL_MAGIC "DDCB"
+#define CONTROL_VERSION 1
+#define CONTROL_LOCK_ATTEMPTS 1000
+
+typedef struct
+{
+    double min_key_delay;       // milliseconds
+    double max_key_delay;
+    double min_move_delay;
+    double max_move_delay;
+    uint32_t distribution;      // distribution_type, only parametric distributions can be set
+    uint32_t reserved;
+    double mean;
+    double std;
+    double mean2;
+    double std2;
+    double weight;
+} control_config;
+
+typedef struct
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t config_size;
+    uint32_t lock;              // 1 while a writer fills the inactive slot
+    uint32_t reserved;
+    uint64_t sequence;          // number of configurations published so far
+    control_config slots[2];
+} control_block;
+
+control_block* open_control_block(const char *name, control_config *initial);
+void close_control_block(control_block *block, const char *name);
+int publish_config(control_block *block, control_config *config);
+uint64_t read_config(control_block *block, control_config *config);
+
+// cheap check for the hot path, a single load
+static inline int control_changed(control_block *block, uint64_t seen)
+{
+    return __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE) != seen;
+}
+
+#endif
@@ -0,0 +1,420 @@
+#include "distribution.h"
+#include "timing.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *distribution_names[] =
+{
+    [linear] = "linear",
+    [normal] = "normal",
+    [lognormal] = "lognormal",
+    [exponential] = "exponential",
+    [gamma_distribution] = "gamma",
+    [pareto] = "pareto",
+    [bimodal] = "bimodal",
+    [empirical] = "file",
+    [trace] = "trace"
+};
+
+// look up a parametric distribution by name, returns 0 if there is none with this name
+int parse_distribution_type(const char *name, distribution_type *type)
+{
+    for(int i = linear; i < empirical; i++)
+    {
+        if(strcmp(name, distribution_names[i]) == 0)
+        {
+            *type = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// name of a distribution type, types from outside (e.g. the control block) may be out of range
+const char* distribution_name(distribution_type type)
+{
+    if((unsigned)type > trace) return "unknown";
+    return distribution_names[type];
+}
+
+// regularized lower incomplete gamma function P(a, x)
+// source: Numerical Recipes in C, 2nd edition, chapter 6.2
+static double gamma_p(double a, double x)
+{
+    if(x <= 0) return 0;
+
+    if(x < a + 1)
+    {
+        // series representation
+        double sum = 1.0 / a, term = sum;
+        for(int n = 1; n < 500; n++)
+        {
+            term *= x / (a + n);
+            sum += term;
+            if(fabs(term) < fabs(sum) * 1e-15) break;
+        }
+        return sum * exp(-x + a * log(x) - lgamma(a));
+    }
+
+    // continued fraction representation of Q(a, x) = 1 - P(a, x)
+    double b = x + 1 - a, c = 1e300, d = 1 / b, h = d;
+    for(int i = 1; i < 500; i++)
+    {
+        double an = -i * (i - a);
+        b += 2;
+        d = an * d + b;
+        if(fabs(d) < 1e-300) d = 1e-300;
+        c = b + an / c;
+        if(fabs(c) < 1e-300) c = 1e-300;
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if(fabs(delta - 1) < 1e-15) break;
+    }
+    return 1 - exp(-x + a * log(x) - lgamma(a)) * h;
+}
+
+// parameters of the untruncated distribution, derived from mean and standard deviation once per table
+typedef struct
+{
+    distribution_type type;
+    double a;
+    double b;
+    double shift;
+    double log_norm;            // logarithm of the normalizing constant of the density, only used by gamma
+    delay_distribution *source;
+} shape;
+
+static void init_shape(shape *s, delay_distribution *d, double min)
+{
+    double mean = d->mean;
+    double std = d->std > 0 ? d->std : 1e-9;
+
+    s->type = d->type;
+    s->source = d;
+    s->shift = 0;
+
+    switch(d->type)
+    {
+    case lognormal:
+        // mu and sigma of the underlying normal distribution
+        s->b = sqrt(log(1 + (std * std) / (mean * mean)));
+        s->a = log(mean) - s->b * s->b / 2;
+        break;
+    case exponential:
+        // shifted to start at the minimum delay
+        s->shift = min;
+        s->a = mean > min ? 1 / (mean - min) : 1e9;
+        break;
+    case gamma_distribution:
+        s->a = (mean * mean) / (std * std);     // shape
+        s->b = (std * std) / mean;              // scale
+        s->log_norm = -lgamma(s->a) - log(s->b);
+        break;
+    case pareto:
+        // the minimum delay is the scale, the shape follows from the mean
+        s->b = min > 0 ? min : 1;
+        s->a = mean > s->b ? mean / (mean - s->b) : 1e9;
+        break;
+    default:
+        s->a = mean;
+        s->b = std;
+        break;
+    }
+}
+
+static double shape_cdf(shape *s, double x)
+{
+    delay_distribution *d = s->source;
+
+    switch(s->type)
+    {
+    case lognormal:
+        return x <= 0 ? 0 : normal_cdf((log(x) - s->a) / s->b);
+    case exponential:
+        return x <= s->shift ? 0 : 1 - exp(-s->a * (x - s->shift));
+    case gamma_distribution:
+        return gamma_p(s->a, x / s->b);
+    case pareto:
+        return x <= s->b ? 0 : 1 - pow(s->b / x, s->a);
+    case bimodal:
+        return d->weight * normal_cdf((x - d->mean) / (d->std > 0 ? d->std : 1e-9))
+             + (1 - d->weight) * normal_cdf((x - d->mean2) / (d->std2 > 0 ? d->std2 : 1e-9));
+    default:
+        return normal_cdf((x - s->a) / s->b);
+    }
+}
+
+// density of a gamma distribution, bounded for a shape of at least 1
+static double gamma_pdf(shape *s, double x)
+{
+    return x <= 0 ? 0 : exp((s->a - 1) * log(x / s->b) - x / s->b + s->log_norm);
+}
+
+// quantile of the untruncated distribution where a closed form exists
+// returns NAN if it has to be found numerically
+static double shape_quantile(shape *s, double p)
+{
+    switch(s->type)
+    {
+    case lognormal:
+        return exp(s->a + s->b * normal_quantile(p));
+    case exponential:
+        return s->shift - log(1 - p) / s->a;
+    case pareto:
+        return s->b / pow(1 - p, 1 / s->a);
+    default:
+        return NAN;
+    }
+}
+
+#define CDF_GRID_SIZE 1024
+#define CDF_BISECTIONS 32
+
+// narrow [lower, upper] down to the values around the one below which a fraction p of the untruncated distribution lies
+static void bracket_quantile(shape *s, double p, double *lower, double *upper)
+{
+    for(int i = 0; i < CDF_BISECTIONS; i++)
+    {
+        double middle = (*lower + *upper) / 2;
+        if(shape_cdf(s, middle) < p) *lower = middle;
+        else *upper = middle;
+    }
+}
+
+// fill the table for a distribution without closed-form quantile
+// the cdf is evaluated on a grid and inverted by linear interpolation, the grid only spans the quantiles
+// the table actually holds, so wide ranges around a narrow distribution don't waste grid points on empty tails
+static void fill_from_cdf(delay_table *table, shape *s, double lower, double upper, double cdf_lower, double cdf_upper)
+{
+    double first = cdf_lower + 0.5 / DELAY_TABLE_SIZE * (cdf_upper - cdf_lower);
+    double last = cdf_lower + (DELAY_TABLE_SIZE - 0.5) / DELAY_TABLE_SIZE * (cdf_upper - cdf_lower);
+    double start = lower, end = upper, above = upper, below = lower;
+    double grid[CDF_GRID_SIZE + 1];
+
+    bracket_quantile(s, first, &start, &above);
+    bracket_quantile(s, last, &below, &end);
+
+    double step = (end - start) / CDF_GRID_SIZE;
+    grid[0] = start == lower ? cdf_lower : shape_cdf(s, start);
+    grid[CDF_GRID_SIZE] = end == upper ? cdf_upper : shape_cdf(s, end);
+
+    if(s->type == gamma_distribution && s->a >= 1)
+    {
+        // gamma_p gets slow for large shapes, integrating the density with Simpson's rule is much cheaper
+        // the integral is scaled to the exact cdf at the end of the grid so the error doesn't add up
+        double density = gamma_pdf(s, start), total = 0;
+        for(int g = 1; g <= CDF_GRID_SIZE; g++)
+        {
+            double x = start + g * step;
+            double next = gamma_pdf(s, x);
+            total += step / 6 * (density + 4 * gamma_pdf(s, x - step / 2) + next);
+            if(g < CDF_GRID_SIZE) grid[g] = total;
+            density = next;
+        }
+        double scale = total > 0 ? (grid[CDF_GRID_SIZE] - grid[0]) / total : 0;
+        for(int g = 1; g < CDF_GRID_SIZE; g++) grid[g] = grid[0] + grid[g] * scale;
+    }
+    else
+    {
+        for(int g = 1; g < CDF_GRID_SIZE; g++) grid[g] = shape_cdf(s, start + g * step);
+    }
+
+    int i = 0;
+    for(int g = 1; g <= CDF_GRID_SIZE && i < DELAY_TABLE_SIZE; g++)
+    {
+        double x = start + (g - 1) * step;
+
+        while(i < DELAY_TABLE_SIZE)
+        {
+            double p = cdf_lower + (i + 0.5) / DELAY_TABLE_SIZE * (cdf_upper - cdf_lower);
+            if(p > grid[g]) break;
+
+            double t = grid[g] > grid[g - 1] ? (p - grid[g - 1]) / (grid[g] - grid[g - 1]) : 0;
+            table->values[i++] = llround((x + t * step) * NSEC_PER_MSEC);
+        }
+    }
+
+    while(i < DELAY_TABLE_SIZE) table->values[i++] = llround(end * NSEC_PER_MSEC);
+}
+
+// fill the table with the quantiles of the distribution, each entry stands for 1/DELAY_TABLE_SIZE of the probability
+// parametric distributions are truncated to [min, max], the quantiles are rounded to whole nanoseconds
+// recording is the delay sequence replayed for this table if the distribution is a trace
+void build_delay_table(delay_table *table, delay_distribution *distribution, delay_trace *recording, double min, double max)
+{
+    truncated_normal range;
+    shape s;
+
+    // histograms and traces already contain absolute delays, min and max don't apply
+    table->alias = distribution->type == empirical ? distribution->histogram : NULL;
+    table->trace = distribution->type == trace ? recording : NULL;
+    if(table->alias || table->trace) return;
+
+    if(distribution->type == normal) init_truncated_normal(&range, distribution->mean, distribution->std, min, max);
+    init_shape(&s, distribution, min);
+
+    double cdf_lower = shape_cdf(&s, min);
+    double cdf_upper = shape_cdf(&s, max);
+    int numeric = distribution->type != linear && distribution->type != normal && isnan(shape_quantile(&s, 0.5));
+
+    if(min != max && numeric && cdf_upper > cdf_lower)
+    {
+        fill_from_cdf(table, &s, min, max, cdf_lower, cdf_upper);
+    }
+
+    for(int i = 0; i < DELAY_TABLE_SIZE; i++)
+    {
+        double p = (i + 0.5) / DELAY_TABLE_SIZE;
+        double x;
+
+        if(min == max) x = min; // add constant delay if no range is specified
+        else if(distribution->type == linear) x = min + p * (max - min);
+        else if(distribution->type == normal) x = truncated_normal_quantile(&range, p);
+        else if(cdf_upper <= cdf_lower) x = cdf_upper <= 0 ? max : min; // no probability within the range, use the closer bound
+        else if(numeric) x = (double)table->values[i] / NSEC_PER_MSEC;
+        else x = shape_quantile(&s, cdf_lower + p * (cdf_upper - cdf_lower));
+
+        if(x < min) x = min;
+        if(x > max) x = max;
+        table->values[i] = llround(x * NSEC_PER_MSEC);
+    }
+}
+
+// fill the table with the entries of two tables built for the same distribution, weighted by 1 - t and t
+// the quantiles move linearly from one delay range to the other, at a fraction of the cost of building the table
+// this only matches the distribution for linear and constant delays, other distributions need a full build
+void blend_delay_tables(delay_table *table, delay_table *start, delay_table *end, double t)
+{
+    // histograms and traces don't depend on the range
+    table->alias = start->alias;
+    table->trace = start->trace;
+    if(table->alias || table->trace) return;
+
+    for(int i = 0; i < DELAY_TABLE_SIZE; i++)
+    {
+        double value = start->values[i] + t * ((double)end->values[i] - (double)start->values[i]);
+        table->values[i] = llround(value);
+    }
+}
+
+// set up the alias table from bucket weights with Vose's algorithm
+// https://www.keithschwarz.com/darts-dice-coins/
+static void build_alias_table(alias_table *table, double *weights)
+{
+    int n = table->size;
+    double total = 0;
+    double *scaled = malloc(n * sizeof(double));
+    int *small = malloc(n * sizeof(int));
+    int *large = malloc(n * sizeof(int));
+    int small_used = 0, large_used = 0;
+
+    for(int i = 0; i < n; i++) total += weights[i];
+
+    for(int i = 0; i < n; i++)
+    {
+        scaled[i] = weights[i] * n / total;
+        if(scaled[i] < 1) small[small_used++] = i;
+        else large[large_used++] = i;
+    }
+
+    while(small_used > 0 && large_used > 0)
+    {
+        int less = small[--small_used];
+        int more = large[--large_used];
+
+        table->threshold[less] = scaled[less] * 4294967296.0;
+        table->alias[less] = more;
+
+        scaled[more] = scaled[more] + scaled[less] - 1;
+        if(scaled[more] < 1) small[small_used++] = more;
+        else large[large_used++] = more;
+    }
+
+    // whatever is left has a probability of 1 (up to rounding errors)
+    while(large_used > 0)
+    {
+        int i = large[--large_used];
+        table->threshold[i] = 1ULL << 32;
+        table->alias[i] = i;
+    }
+    while(small_used > 0)
+    {
+        int i = small[--small_used];
+        table->threshold[i] = 1ULL << 32;
+        table->alias[i] = i;
+    }
+
+    free(scaled);
+    free(small);
+    free(large);
+}
+
+// load a delay histogram from a text file
+// every line contains a delay in microseconds and its weight, separated by whitespace, ',' or ';'
+// empty lines and lines starting with '#' are ignored
+// returns NULL if the file can't be read or contains no buckets with a positive weight
+alias_table* load_histogram(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(file == NULL) return NULL;
+
+    int size = 0, capacity = 64;
+    uint64_t *values = malloc(capacity * sizeof(uint64_t));
+    double *weights = malloc(capacity * sizeof(double));
+    char line[256];
+
+    while(fgets(line, sizeof(line), file))
+    {
+        double delay, weight;
+
+        for(char *c = line; *c; c++)
+        {
+            if(*c == ',' || *c == ';') *c = ' ';
+        }
+
+        if(line[0] == '#' || sscanf(line, "%lf %lf", &delay, &weight) != 2) continue;
+        if(weight <= 0 || delay < 0) continue;
+
+        if(size == capacity)
+        {
+            capacity *= 2;
+            values = realloc(values, capacity * sizeof(uint64_t));
+            weights = realloc(weights, capacity * sizeof(double));
+        }
+
+        values[size] = llround(delay * 1000);
+        weights[size] = weight;
+        size++;
+    }
+    fclose(file);
+
+    if(size == 0)
+    {
+        free(values);
+        free(weights);
+        return NULL;
+    }
+
+    alias_table *table = malloc(sizeof(alias_table));
+    table->size = size;
+    table->values = values;
+    table->threshold = malloc(size * sizeof(uint64_t));
+    table->alias = malloc(size * sizeof(int));
+    build_alias_table(table, weights);
+
+    free(weights);
+    return table;
+}
+
+void free_histogram(alias_table *histogram)
+{
+    if(histogram == NULL) return;
+
+    free(histogram->values);
+    free(histogram->threshold);
+    free(histogram->alias);
+    free(histogram);
+}
@@ -0,0 +1,82 @@
+#ifndef _DISTRIBUTION_H_
+#define _DISTRIBUTION_H_
+
+#include "random.h"
+#include "trace.h"
+
+// every delay distribution is turned into a table of quantiles when its parameters are set
+// drawing a delay then only takes one random number and a table lookup, no matter the distribution
+#define DELAY_TABLE_BITS 12
+#define DELAY_TABLE_SIZE (1 << DELAY_TABLE_BITS)
+
+typedef enum
+{
+    linear,
+    normal,
+    lognormal,
+    exponential,
+    gamma_distribution,         // not just gamma, that would shadow gamma() from math.h
+    pareto,
+    bimodal,
+    empirical,
+    trace
+} distribution_type;
+
+// measured delay histogram prepared for Walker's alias method
+// each bucket is either kept or replaced by its alias, so a sample needs one random number and one comparison
+typedef struct
+{
+    int size;
+    uint64_t *values;           // delay of each bucket in nanoseconds
+    uint64_t *threshold;        // probability of keeping the bucket instead of its alias, scaled to 2^32
+    int *alias;
+} alias_table;
+
+// parametric distributions are described by their mean and standard deviation
+// bimodal distributions mix a second normal distribution (mean2, std2) into the first one, weight is the share of the first
+typedef struct
+{
+    distribution_type type;
+    double mean;
+    double std;
+    double mean2;
+    double std2;
+    double weight;
+    alias_table *histogram;     // only used by empirical distributions
+    delay_trace *key_trace;     // only used by traces, key and move events are replayed separately
+    delay_trace *move_trace;
+} delay_distribution;
+
+// parameters (mean, std, min and max) are given in milliseconds, the table holds delays in nanoseconds
+typedef struct
+{
+    uint64_t values[DELAY_TABLE_SIZE];
+    alias_table *alias;         // empirical distributions are sampled from their histogram instead
+    delay_trace *trace;         // traces are replayed in order instead
+} delay_table;
+
+int parse_distribution_type(const char *name, distribution_type *type);
+const char* distribution_name(distribution_type type);
+alias_table* load_histogram(const char *path);
+void free_histogram(alias_table *histogram);
+void build_delay_table(delay_table *table, delay_distribution *distribution, delay_trace *recording, double min, double max);
+void blend_delay_tables(delay_table *table, delay_table *start, delay_table *end, double t);
+
+static inline uint64_t sample_alias(rng_state *rng, alias_table *table)
+{
+    uint64_t u = rng_next(rng);
+    uint32_t bucket = ((u >> 32) * table->size) >> 32;
+
+    return (u & 0xffffffff) < table->threshold[bucket] ? table->values[bucket] : table->values[table->alias[bucket]];
+}
+
+// draw a delay in nanoseconds from a table built by build_delay_table
+static inline uint64_t sample_delay(rng_state *rng, delay_table *table)
+{
+    if(table->trace) return next_trace_value(table->trace);
+    if(table->alias) return sample_alias(rng, table->alias);
+
+    return table->values[rng_next(rng) >> (64 - DELAY_TABLE_BITS)];
+}
+
+#endif
@@ -0,0 +1,83 @@
+#include "heap.h"
+
+static int entry_before(heap_entry *a, heap_entry *b)
+{
+    if(a->event->due != b->event->due) return a->event->due < b->event->due;
+    return a->seq < b->seq;
+}
+
+static void swap_entries(heap_entry *a, heap_entry *b)
+{
+    heap_entry tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+void init_heap(event_heap *h, size_t size)
+{
+    h->entries = malloc(size * sizeof(heap_entry));
+    h->used = 0;
+    h->size = size;
+    h->seq = 0;
+}
+
+void push_heap(event_heap *h, delayed_event *event)
+{
+    // upgrade allocated memory if necessary
+    if(h->used >= h->size)
+    {
+        h->size *= 2;
+        h->entries = realloc(h->entries, h->size * sizeof(heap_entry));
+    }
+
+    size_t i = h->used++;
+    h->entries[i].event = event;
+    h->entries[i].seq = h->seq++;
+
+    // sift up
+    while(i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if(!entry_before(&h->entries[i], &h->entries[parent])) break;
+        swap_entries(&h->entries[i], &h->entries[parent]);
+        i = parent;
+    }
+}
+
+delayed_event* peek_heap(event_heap *h)
+{
+    return h->used > 0 ? h->entries[0].event : NULL;
+}
+
+delayed_event* pop_heap(event_heap *h)
+{
+    if(h->used == 0) return NULL;
+
+    delayed_event *event = h->entries[0].event;
+    h->entries[0] = h->entries[--h->used];
+
+    // sift down
+    size_t i = 0;
+    while(1)
+    {
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        size_t smallest = i;
+
+        if(left < h->used && entry_before(&h->entries[left], &h->entries[smallest])) smallest = left;
+        if(right < h->used && entry_before(&h->entries[right], &h->entries[smallest])) smallest = right;
+        if(smallest == i) break;
+
+        swap_entries(&h->entries[i], &h->entries[smallest]);
+        i = smallest;
+    }
+
+    return event;
+}
+
+void free_heap(event_heap *h)
+{
+    free(h->entries);
+    h->entries = NULL;
+    h->used = h->size = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef _HEAP_H_
+#define _HEAP_H_
+
+#include "log.h"
+
+typedef struct
+{
+    delayed_event* event;
+    unsigned long seq;          // insertion order, keeps events with the same due time in order
+} heap_entry;
+
+// binary min-heap of pending events ordered by their due time
+typedef struct
+{
+    size_t size;
+    size_t used;
+    unsigned long seq;
+    heap_entry* entries;
+} event_heap;
+
+void init_heap(event_heap *h, size_t size);
+void push_heap(event_heap *h, delayed_event *event);
+delayed_event* peek_heap(event_heap *h);
+delayed_event* pop_heap(event_heap *h);
+void free_heap(event_heap *h);
+
+#endif
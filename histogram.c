@@ -0,0 +1,42 @@
+#include "histogram.h"
+#include <string.h>
+
+void clear_histogram(histogram *h)
+{
+    memset(h, 0, sizeof(histogram));
+}
+
+// largest value that is recorded in the same bucket as the values of the given index
+static uint64_t highest_value(int index)
+{
+    if(index < HISTOGRAM_SUB_COUNT) return index;
+
+    int shift = (index - HISTOGRAM_SUB_COUNT) / HISTOGRAM_HALF_COUNT + 1;
+    uint64_t sub = (index - HISTOGRAM_SUB_COUNT) % HISTOGRAM_HALF_COUNT + HISTOGRAM_HALF_COUNT;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+// value below which the given percentage of all recorded values lie
+// like HdrHistogram the upper end of the bucket is reported, so percentiles are never underestimated
+uint64_t histogram_percentile(histogram *h, double percentile)
+{
+    if(h->total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100 * h->total + 0.5);
+    if(rank < 1) rank = 1;
+    if(rank > h->total) rank = h->total;
+
+    uint64_t seen = 0;
+    for(int i = 0; i < HISTOGRAM_SIZE; i++)
+    {
+        seen += h->counts[i];
+        if(seen >= rank)
+        {
+            uint64_t value = highest_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+
+    return h->max;
+}
@@ -0,0 +1,40 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+// log-linear histogram in the style of HdrHistogram
+// values below 2^HISTOGRAM_SUB_BITS get a bucket each, above that every power of two is split into
+// 2^(HISTOGRAM_SUB_BITS-1) buckets, so any value is recorded with a relative error below 1%
+// recording is a few instructions and never allocates, so it can be used on the hot path
+#define HISTOGRAM_SUB_BITS 8
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+#define HISTOGRAM_SIZE (HISTOGRAM_SUB_COUNT + (64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_HALF_COUNT)
+
+typedef struct
+{
+    uint64_t counts[HISTOGRAM_SIZE];
+    uint64_t total;
+    uint64_t max;
+} histogram;
+
+void clear_histogram(histogram *h);
+uint64_t histogram_percentile(histogram *h, double percentile);
+
+static inline int histogram_index(uint64_t value)
+{
+    if(value < HISTOGRAM_SUB_COUNT) return value;
+
+    int shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+    return HISTOGRAM_SUB_COUNT + (shift - 1) * HISTOGRAM_HALF_COUNT + (int)(value >> shift) - HISTOGRAM_HALF_COUNT;
+}
+
+static inline void record_value(histogram *h, uint64_t value)
+{
+    h->counts[histogram_index(value)]++;
+    h->total++;
+    if(value > h->max) h->max = value;
+}
+
+#endif
@@ -1,56 +1,240 @@
+#define _GNU_SOURCE // fallocate
 #include "log.h"
+#include "realtime.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
 
-const char* log_file = "event_log.csv";
+const char* log_prefix = "event_log";
 
-// https://stackoverflow.com/a/3536261
-void init_vector(event_vector *ev, size_t size)
+#define LOG_SYNC_INTERVAL 1     // seconds between two syncs to disk
+#define LOG_IDLE_SLEEP 10       // milliseconds the writer sleeps when there is nothing to write
+#define LOG_RETRY_INTERVAL 5    // seconds until a new segment is tried after creating one failed
+
+// single-producer single-consumer ring buffer between the event loop and the writer thread
+// the event loop only copies a record and publishes it, file I/O happens on the writer thread
+static log_record *ring = NULL;
+static size_t ring_size = 0;            // always a power of two
+static atomic_size_t ring_head = 0;     // next slot written by the event loop
+static atomic_size_t ring_tail = 0;     // next slot read by the writer thread
+static atomic_ulong dropped_records = 0;  // counted by both the event loop and the writer thread
+
+static pthread_t writer_thread;
+static atomic_int writer_running = 0;
+
+// the log is split into preallocated segment files (event_log.0000.bin, event_log.0001.bin, ...)
+// records are written straight into the memory mapped active segment
+static size_t segment_size = 0;         // number of records per segment
+static int segment_index = 0;
+static int segment_fd = -1;
+static log_header *segment = NULL;
+static log_record *segment_records = NULL;
+static uint64_t segment_used = 0;
+static time_t segment_retry = 0;        // no new segment is created before this time
+
+// publish the number of valid records in the segment header
+// processes tailing the active segment read this count before reading records
+static void publish_record_count()
 {
-    ev->events = malloc(size * sizeof(delayed_event));
-    ev->used = 0;
-    ev->size = size;
+    __atomic_store_n(&segment->record_count, htole64(segment_used), __ATOMIC_RELEASE);
 }
 
-void append_to_vector(event_vector *ev, delayed_event event)
+static void close_segment()
 {
-    // upgrade allocated memory if necessary
-    if(ev->used >= ev->size)
+    if(segment == NULL) return;
+
+    size_t length = sizeof(log_header) + segment_used * sizeof(log_record);
+
+    publish_record_count();
+    msync(segment, length, MS_SYNC);
+    munmap(segment, sizeof(log_header) + segment_size * sizeof(log_record));
+
+    // the last segment is usually not full, don't leave the preallocated space behind
+    if(ftruncate(segment_fd, length) < 0) perror("Failed to truncate event log segment");
+    close(segment_fd);
+
+    segment = NULL;
+    segment_fd = -1;
+}
+
+// create, preallocate and map the next segment file that doesn't exist yet
+static int open_segment()
+{
+    char path[64];
+    size_t length = sizeof(log_header) + segment_size * sizeof(log_record);
+
+    do
+    {
+        snprintf(path, sizeof(path), "%s.%04d.bin", log_prefix, segment_index++);
+        segment_fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    while(segment_fd < 0 && errno == EEXIST);
+
+    if(segment_fd < 0) return 0;
+
+    // fall back to a sparse file only on file systems that don't support fallocate
+    // any other error (e.g. a full disk) would make writing to the mapping fail with SIGBUS later
+    int rc = fallocate(segment_fd, 0, 0, length);
+    if(rc < 0 && errno == EOPNOTSUPP) rc = ftruncate(segment_fd, length);
+
+    if(rc == 0) segment = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd, 0);
+    if(rc < 0 || segment == MAP_FAILED)
     {
-        ev->size *= 2;
-        ev->events = realloc(ev->events, ev->size * sizeof(delayed_event));
+        int error = errno;
+
+        close(segment_fd);
+        unlink(path);
+        segment = NULL;
+        segment_fd = -1;
+
+        errno = error;
+        return 0;
     }
-    ev->events[ev->used++] = event;
+
+    segment_records = (log_record*)(segment + 1);
+    segment_used = 0;
+
+    memcpy(segment->magic, LOG_MAGIC, 4);
+    segment->version = htole16(LOG_VERSION);
+    segment->record_size = htole16(sizeof(log_record));
+    publish_record_count();
+
+    return 1;
 }
 
-void free_vector(event_vector *ev)
+// replace the full (or missing) active segment with a new one
+// after a failure no new file is tried for LOG_RETRY_INTERVAL seconds
+static int next_segment()
 {
-    free(ev->events);
-    ev->events = NULL;
-    ev->used = ev->size = 0;
+    if(segment == NULL && time(NULL) < segment_retry) return 0;
+
+    close_segment();
+    if(open_segment()) return 1;
+
+    perror("Failed to open event log segment");
+    segment_retry = time(NULL) + LOG_RETRY_INTERVAL;
+    return 0;
 }
 
-void write_event_log(event_vector *ev)
+// move all records that are currently in the ring to the active segment
+// records are dropped and counted while there is no segment to write to
+// returns the number of records moved
+static size_t drain_ring()
 {
-    // write header if file doesn't exist
-    if(access(log_file, F_OK) != 0)
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+    for(size_t i = tail; i != head; i++)
     {
-        FILE *file = fopen(log_file, "w+");
-        const char* header = "timestamp;delay;type;value;code\n";
-        fwrite(header, 1, strlen(header), file);
-        fclose(file);
+        if((segment == NULL || segment_used == segment_size) && !next_segment())
+        {
+            atomic_fetch_add_explicit(&dropped_records, head - i, memory_order_relaxed);
+            break;
+        }
+
+        log_record *record = &ring[i & (ring_size - 1)];
+        log_record *out = &segment_records[segment_used++];
+
+        out->timestamp = htole64(record->timestamp);
+        out->emitted = htole64(record->emitted);
+        out->delay = htole64(record->delay);
+        out->type = htole16(record->type);
+        out->code = htole16(record->code);
+        out->value = htole32(record->value);
     }
 
-    FILE *file = fopen(log_file, "a");
-    for(int i=0; i<ev->used; ++i)
+    if(segment != NULL && head != tail) publish_record_count();
+
+    atomic_store_explicit(&ring_tail, head, memory_order_release);
+    return head - tail;
+}
+
+// copy records to the log as they come in, the active segment is synced to disk periodically
+static void *write_event_log(void *args)
+{
+    time_t last_sync = time(NULL);
+    struct timespec idle = {0, LOG_IDLE_SLEEP * 1000000L};
+
+    while(atomic_load(&writer_running))
     {
-        delayed_event evnt = ev->events[i];
-        fprintf(file,
-                "%lu;%i;%i;%i;%i\n",
-                evnt.timestamp,
-                evnt.delay,
-                evnt.type,
-                evnt.value,
-                evnt.code);
+        if(drain_ring() == 0) nanosleep(&idle, NULL);
+
+        if(segment != NULL && time(NULL) - last_sync >= LOG_SYNC_INTERVAL)
+        {
+            msync(segment, sizeof(log_header) + segment_used * sizeof(log_record), MS_SYNC);
+            last_sync = time(NULL);
+        }
     }
-    fclose(file);
-    free_vector(ev);
-}
\ No newline at end of file
+
+    drain_ring();
+    close_segment();
+
+    return NULL;
+}
+
+// create the first log segment and start the writer thread
+// size is the number of records that can be buffered, it is rounded up to a power of two
+// records is the number of records per segment file
+int init_event_log(size_t size, size_t records)
+{
+    ring_size = 1;
+    while(ring_size < size) ring_size *= 2;
+    ring = malloc(ring_size * sizeof(log_record));
+    if(ring == NULL) return 0;
+
+    segment_size = records;
+    if(!open_segment()) return 0;
+
+    atomic_store(&writer_running, 1);
+    if(pthread_create(&writer_thread, NULL, write_event_log, NULL) != 0) return 0;
+
+    return 1;
+}
+
+// keep the writer thread on the given CPU, away from the event loop
+int pin_event_log(int cpu)
+{
+    return pin_thread(writer_thread, cpu);
+}
+
+// hand an emitted event over to the writer thread
+// never blocks, if the writer can't keep up the record is dropped and counted
+void log_event(delayed_event *event, uint64_t emitted)
+{
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+
+    if(head - tail >= ring_size)
+    {
+        atomic_fetch_add_explicit(&dropped_records, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record *record = &ring[head & (ring_size - 1)];
+    record->timestamp = event->timestamp;
+    record->emitted = emitted;
+    record->delay = event->delay;
+    record->type = event->type;
+    record->code = event->code;
+    record->value = event->value;
+
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+// write the remaining records and stop the writer thread
+void close_event_log()
+{
+    if(ring == NULL) return;
+
+    atomic_store(&writer_running, 0);
+    pthread_join(writer_thread, NULL);
+
+    unsigned long dropped = atomic_load(&dropped_records);
+    if(dropped > 0) printf("event log dropped %lu records\n", dropped);
+
+    free(ring);
+    ring = NULL;
+}
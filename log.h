@@ -5,26 +5,51 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
 
-typedef struct
+typedef struct delayed_event
 {
     int type;                   // event type (e.g. key press, relative movement, ...)
     int code;                   // event code (e.g. for key pressses the key/button code)
     int value;                  // event value (e.g. 0/1 for button up/down, coordinates for absolute movement, ...)
-    int delay;                  // delay time for the event in milliseconds
-    unsigned long timestamp;    // time the event occured
+    uint64_t delay;             // delay time for the event in nanoseconds, timestamp + delay is its deadline
+    uint64_t timestamp;         // time the event occured on CLOCK_MONOTONIC in nanoseconds
+    uint64_t due;               // absolute time on CLOCK_MONOTONIC (in nanoseconds) at which the event is emitted
+    int syn;                    // last event of its frame, a SYN_REPORT is emitted after it
+    uint64_t sequence;          // order in which events were added to the timer wheel
+    struct delayed_event *next; // next event in the same timer wheel slot
 } delayed_event;
 
+// the event log is a series of binary segment files, each consisting of a header followed by fixed-size records
+// all fields are stored little-endian, delaydaemon-logdump converts the log to CSV
+// the active segment can be tailed by mapping it read-only: record_count is updated
+// with release semantics after new records have been written
+#define LOG_MAGIC "DDLG"
+#define LOG_VERSION 2
+
+typedef struct
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t record_count;      // number of valid records in the segment
+    uint8_t reserved[16];
+} log_header;
+
 typedef struct
 {
-    size_t size;
-    size_t used;
-    delayed_event* events;
-} event_vector;
+    int64_t timestamp;          // time the input event occured on CLOCK_MONOTONIC in nanoseconds
+    int64_t emitted;            // time the event was written to the virtual device on CLOCK_MONOTONIC in nanoseconds
+    uint64_t delay;             // intended delay in nanoseconds, emitted - (timestamp + delay) is the emit error
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+} log_record;
 
-void init_vector(event_vector *ev, size_t size);
-void append_to_vector(event_vector *ev, delayed_event event);
-void free_vector(event_vector *ev);
-void write_event_log(event_vector *ev);
+int init_event_log(size_t size, size_t records);
+int pin_event_log(int cpu);
+void log_event(delayed_event *event, uint64_t emitted);
+void close_event_log();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,76 @@
+// converts a binary event log written by DelayDaemon to CSV
+// the output has the same columns as the CSV log of earlier versions (timestamp;delay;type;value;code)
+// timestamps and delays are printed in milliseconds with nanosecond precision, timestamps are on CLOCK_MONOTONIC
+//
+// usage: delaydaemon-logdump FILE... > event_log.csv
+
+#include <endian.h>
+#include "log.h"
+
+// print all records of one log segment
+// returns 0 if the file is not a valid event log
+int dump_segment(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+    {
+        perror("Failed to open event log");
+        return 0;
+    }
+
+    log_header header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, LOG_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "%s is not a DelayDaemon event log\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    if(le16toh(header.version) != LOG_VERSION || le16toh(header.record_size) != sizeof(log_record))
+    {
+        fprintf(stderr, "unsupported event log version %d\n", le16toh(header.version));
+        fclose(file);
+        return 0;
+    }
+
+    // segments are preallocated, only the first record_count records are valid
+    uint64_t count = le64toh(header.record_count);
+    log_record records[4096];
+    size_t read;
+    uint64_t total = 0;
+
+    while(total < count && (read = fread(records, sizeof(log_record), 4096, file)) > 0)
+    {
+        for(size_t i = 0; i < read && total < count; i++, total++)
+        {
+            log_record *record = &records[i];
+            printf("%.6f;%.6f;%u;%i;%u\n",
+                    (int64_t)le64toh(record->timestamp) / 1e6,
+                    le64toh(record->delay) / 1e6,
+                    le16toh(record->type),
+                    (int32_t)le32toh(record->value),
+                    le16toh(record->code));
+        }
+    }
+
+    fclose(file);
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("timestamp;delay;type;value;code\n");
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!dump_segment(argv[i])) return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
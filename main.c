@@ -7,179 +7,984 @@
 #include <fcntl.h>
 #include <time.h>
 #include <string.h>
-#include <pthread.h> 
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <signal.h>
 #include <math.h>
+#include <sys/prctl.h>
 #include "args.h"
 #include "log.h"
+#include "timerwheel.h"
+#include "pool.h"
+#include "random.h"
+#include "distribution.h"
+#include "timing.h"
+#include "realtime.h"
+#include "histogram.h"
+#include "control.h"
+#include "server.h"
+#include "profile.h"
+#include "policy.h"
+#include "config.h"
 #include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
 
 struct arguments args;
 int DEBUG = 0;
 
-event_vector ev;     // vector of all input events
+// the command line is parsed again whenever the configuration file changes, so its options keep overriding the file
+int config_argc;
+char **config_argv;
+int config_fd = -1;                 // inotify fd watching the configuration file
 
 char* event_handle; // event handle of the input event we want to add delay to (normally somewhere in /dev/input/)
 
 int fifo_fd = -1;    // path to FIFO for remotely controlled delay times
 char* fifo_path;
-pthread_t fifo_thread; 
+char fifo_buffer[SERVER_MESSAGE_SIZE];
+size_t fifo_buffer_used = 0;
 
-// use attributes to create threads in a detached state
-pthread_attr_t invoked_event_thread_attr, log_delay_val_thread_attr;
+// delay profile changing the delay ranges over time, driven by its own timerfd
+delay_profile *profile = NULL;
+int profile_fd = -1;
 
+// control socket, every other fd in the event loop belongs to one of its clients
+int server_fd = -1;
+char* socket_path;
+
+// everything runs in a single epoll loop waiting on the input device, the FIFO and a timerfd
+// the timerfd is armed to the next deadline of the timing wheel holding all pending events
+int epoll_fd = -1;
+int timer_fd = -1;
+timer_wheel pending;
+uint64_t tick_length = 10000;       // timer wheel granularity in nanoseconds
+uint64_t timer_deadline = 0;        // time the timerfd is currently armed to, 0 if disarmed
+volatile sig_atomic_t running = 1;
+volatile sig_atomic_t report_requested = 0;
+int paused = 0;                     // frames are passed on without delay while paused
+unsigned long emitted_events = 0;
+
+// how late events are emitted compared to their deadline, in nanoseconds
+// kept separately for key events, relative and absolute movement and everything else
+enum{
+    error_key,
+    error_rel,
+    error_abs,
+    error_other,
+    error_classes
+};
+const char *error_class_names[] = {"key", "rel", "abs", "other"};
+histogram emit_error[error_classes];
+
+// precision mode: the timerfd is armed spin_margin before the next deadline and the rest is busy-waited
+// with auto tuning the margin follows the wakeup latency of the timer
+#define SPIN_MARGIN_MIN 2000        // nanoseconds
+#define SPIN_MARGIN_MAX 1000000
+int spin_mode = 0;
+int spin_auto = 0;
+uint64_t spin_margin = 50000;
+unsigned long spin_count = 0;
+uint64_t spin_time = 0;
+
+// events of the current frame, they are delayed together once the frame is complete
+#define FRAME_SIZE 64
+delayed_event *frame[FRAME_SIZE];
+int frame_used = 0;
+uint64_t last_frame_due = 0;
+
+// delayed events are taken from a fixed-size pool instead of being allocated one by one
+// if all slots are pending, new events are dropped, passed on without delay, or the reader waits for a free slot
+event_pool pool;
+size_t pool_size = 4096;
 enum{
-    linear,
-    normal
-} distribution;
+    pool_drop,
+    pool_bypass,
+    pool_block
+} pool_policy = pool_block;
+unsigned long dropped_events = 0;
+unsigned long bypassed_events = 0;
+int bypassed_in_frame = 0;
+
+// events are read from the device fd directly in batches unless read_batch is 0
+#define MAX_READ_BATCH 256
+int read_batch = 0;
+unsigned long read_calls = 0;
+unsigned long read_events = 0;
+int max_read_events = 0;
+
+delay_distribution distribution;
 
-// normal distribution variables
-double mu = -1.0;
-double sigma = -1.0;
+// random number generator owned by the event loop
+rng_state rng;
+uint64_t seed;
 
-// delay range for key events
-int min_delay_key = -1;
-int max_delay_key = -1;
+// delay tables for key events and mouse movement
+// they are rebuilt whenever the delay ranges or the distribution change
+delay_table key_delays, move_delays;
 
-// delay range for mouse movement
+// tables for both ends of the ramp a profile is running, ranges on the ramp are blended from them
+// so a ramp step costs one pass over the table instead of a build
+// blending is only exact for linear delays, constant delays, histograms and traces, other distributions are rebuilt
+#define RAMP_TOLERANCE 1e-6         // milliseconds
+typedef struct
+{
+    int active;                 // the ramp's tables are set up and can be blended
+    double from[2];             // min and max delay at the start of the ramp
+    double to[2];               // min and max delay at its end
+    delay_table start;
+    delay_table end;
+} table_ramp;
+table_ramp key_ramp, move_ramp;
+
+// delay policies for single event codes and types, NULL unless --policies is given
+// replaced as a whole when the file is reloaded (SIGHUP or the policy command)
+policy_table *policies = NULL;
+char *policy_path = NULL;
+volatile sig_atomic_t reload_requested = 0;
+
+// delay configuration shared with external controllers, NULL unless --shm is given
+control_block *control = NULL;
+char *control_name = NULL;
+uint64_t control_sequence = 0;      // configuration the delay tables were built from
+control_config queued_config;       // latest configuration set by a command, applied once per pass through the event loop
+int config_queued = 0;
+int config_blocked = 0;             // the control block lock was taken when the queued configuration was published
+
+// delay range for key events in milliseconds
+double min_delay_key = -1;
+double max_delay_key = -1;
+
+// delay range for mouse movement in milliseconds
 // note that variance here causes the movement to stutter
-int min_delay_move = -1;
-int max_delay_move = -1;
+double min_delay_move = -1;
+double max_delay_move = -1;
 
 struct libevdev *event_dev = NULL;
-struct libevdev *uinput_dev = NULL;
+int kernel_timestamps = 0;          // the device reports event times on CLOCK_MONOTONIC
+struct libevdev_uinput *uinput_dev = NULL;
+int uinput_fd = -1;
+
+#define EMIT_BATCH_SIZE 256
+#define LOG_BUFFER_SIZE 65536       // number of log records buffered for the writer thread
 int polling_rate = 8192;
 
-// returns a normally distributed value around an average mu with std sigma
-// source: https://phoxis.org/2013/05/04/generating-random-numbers-from-normal-distribution-in-c/
-int randn (double mu, double sigma)
+// load the delay traces given as KEYPATH[,MOVEPATH]
+// key delays are taken from the key frames of an event log, move delays from the other frames
+int load_traces(delay_distribution *d, const char *paths)
+{
+    char key_path[4096];
+    snprintf(key_path, sizeof(key_path), "%s", paths);
+
+    char *move_path = strchr(key_path, ',');
+    if(move_path) *move_path++ = '\0';
+    else move_path = key_path;
+
+    d->type = trace;
+    d->key_trace = load_trace(key_path, trace_keys);
+    d->move_trace = load_trace(move_path, trace_moves);
+
+    if(d->key_trace == NULL || d->move_trace == NULL)
+    {
+        printf("Failed to load %s delays from %s\n", d->key_trace ? "move" : "key", d->key_trace ? move_path : key_path);
+        free_trace(d->key_trace);
+        free_trace(d->move_trace);
+        return 0;
+    }
+
+    if(DEBUG) printf("Delay traces: %zu key delays, %zu move delays\n", d->key_trace->count, d->move_trace->count);
+    return 1;
+}
+
+// set up the distribution given on the command line or in the configuration file
+// histograms and traces are loaded from their files, returns 0 if that fails
+int load_distribution(struct arguments *a, delay_distribution *d)
 {
-  double U1, U2, W, mult;
-  static double X1, X2;
-  static int call = 0;
- 
-  if (call == 1)
+    memset(d, 0, sizeof(delay_distribution));
+    d->mean = a->mean;
+    d->std = a->std;
+    d->mean2 = a->mean2;
+    d->std2 = a->std2;
+    d->weight = a->weight;
+
+    if(strncmp(a->distribution, "file:", 5) == 0)
     {
-      call = !call;
-      return (mu + sigma * (double) X2);
+        d->type = empirical;
+        d->histogram = load_histogram(a->distribution + 5);
+        if(d->histogram == NULL)
+        {
+            printf("Failed to load delay histogram from %s\n", a->distribution + 5);
+            return 0;
+        }
     }
- 
-  do
+    else if(strncmp(a->distribution, "trace:", 6) == 0)
     {
-      U1 = -1 + ((double) rand () / RAND_MAX) * 2;
-      U2 = -1 + ((double) rand () / RAND_MAX) * 2;
-      W = pow (U1, 2) + pow (U2, 2);
+        if(!load_traces(d, a->distribution + 6)) return 0;
     }
-  while (W >= 1 || W == 0);
- 
-  mult = sqrt ((-2 * log (W)) / W);
-  X1 = U1 * mult;
-  X2 = U2 * mult;
- 
-  call = !call;
- 
-  return (mu + sigma * (double) X1);
+    else if(!parse_distribution_type(a->distribution, &d->type)) d->type = linear;
+
+    return 1;
+}
+
+// free the histogram or traces of a distribution that is no longer used
+void free_distribution(delay_distribution *d)
+{
+    free_histogram(d->histogram);
+    free_trace(d->key_trace);
+    free_trace(d->move_trace);
 }
 
-// generate a delay time for an input event
-// this function uses a linear distribution between min_delay_move and max_delay_move
-// other distributions (e.g. gaussian) may be added in the future
-int calculate_delay(int min, int max)
+// build the tables for both ends of a ramp from the min and max delays at its ends
+// nothing is built if the ramp is the one that is already set up, unless force is given,
+// nor if blending the tables wouldn't give the same table as building it for the current distribution
+void build_ramp(table_ramp *ramp, delay_trace *recording, double *from, double *to, int force)
 {
-    if(min == max) return min; // add constant delay if no range is specified
-    else if(distribution == linear) return min + (rand() % (max - min));
-    else if(distribution == normal)
+    // make sure max >= min
+    double start[2] = {from[0], from[1] < from[0] ? from[0] : from[1]};
+    double end[2] = {to[0], to[1] < to[0] ? to[0] : to[1]};
+
+    int same = ramp->active && memcmp(start, ramp->from, sizeof(start)) == 0 && memcmp(end, ramp->to, sizeof(end)) == 0;
+    if(same && !force) return;
+
+    memcpy(ramp->from, start, sizeof(start));
+    memcpy(ramp->to, end, sizeof(end));
+    int constant = start[0] == start[1] && end[0] == end[1];
+    int exact = distribution.type == linear || distribution.type >= empirical || constant;
+    ramp->active = memcmp(start, end, sizeof(start)) != 0 && exact;
+    if(!ramp->active) return;
+
+    build_delay_table(&ramp->start, &distribution, recording, start[0], start[1]);
+    build_delay_table(&ramp->end, &distribution, recording, end[0], end[1]);
+}
+
+// position of a delay range on the ramp between 0 and 1, -1 if the range isn't on it
+double ramp_position(table_ramp *ramp, double min, double max)
+{
+    if(!ramp->active) return -1;
+
+    // the bound that moves further decides, the other one has to match
+    int bound = fabs(ramp->to[1] - ramp->from[1]) > fabs(ramp->to[0] - ramp->from[0]);
+    double t = ((bound ? max : min) - ramp->from[bound]) / (ramp->to[bound] - ramp->from[bound]);
+    if(t < 0 || t > 1) return -1;
+
+    if(fabs(ramp->from[0] + t * (ramp->to[0] - ramp->from[0]) - min) > RAMP_TOLERANCE) return -1;
+    if(fabs(ramp->from[1] + t * (ramp->to[1] - ramp->from[1]) - max) > RAMP_TOLERANCE) return -1;
+    return t;
+}
+
+// build the table for a new delay range, ranges on a ramp are blended from the tables at its ends
+void build_range_table(delay_table *table, table_ramp *ramp, delay_trace *recording, double min, double max)
+{
+    double t = ramp_position(ramp, min, max);
+
+    if(t >= 0) blend_delay_tables(table, &ramp->start, &ramp->end, t);
+    else build_delay_table(table, &distribution, recording, min, max);
+}
+
+// build the delay tables for the current delay ranges
+// needs to be called whenever the distribution changes, for new ranges build_range_table is enough
+void update_distributions()
+{
+    build_delay_table(&key_delays, &distribution, distribution.key_trace, min_delay_key, max_delay_key);
+    build_delay_table(&move_delays, &distribution, distribution.move_trace, min_delay_move, max_delay_move);
+    if(policies) build_policy_tables(policies, &distribution, distribution.key_trace);
+
+    // the ends of a running ramp were built for the old distribution, which may not even allow blending
+    build_ramp(&key_ramp, distribution.key_trace, key_ramp.from, key_ramp.to, 1);
+    build_ramp(&move_ramp, distribution.move_trace, move_ramp.from, move_ramp.to, 1);
+}
+
+// load the delay policies from a file and replace the current ones
+// the current policies are kept if the file can't be loaded
+int reload_policies(const char *path)
+{
+    policy_table *loaded = load_policies(path);
+    if(loaded == NULL) return 0;
+
+    build_policy_tables(loaded, &distribution, distribution.key_trace);
+
+    // pending events don't refer to the policies, the old ones can go right away
+    free_policies(policies);
+    policies = loaded;
+
+    // a new path is only remembered once its file loaded, so a bad path doesn't break later reloads
+    if(path != policy_path)
     {
-        int x = -1;
-        while(x < min || x > max)
+        free(policy_path);
+        policy_path = strdup(path);
+    }
+
+    if(DEBUG) printf("loaded %d delay policies from %s\n", policies->count - 1, path);
+    return 1;
+}
+
+// write a batch of input events to the virtual input device with a single syscall
+void write_events(struct input_event *batch, size_t count)
+{
+    if(count == 0) return;
+
+    ssize_t rc = write(uinput_fd, batch, count * sizeof(struct input_event));
+    if(rc < 0) printf("Failed to write uinput events: %s\n", strerror(errno));
+}
+
+// write a single event to the virtual input device without delay
+void write_event(int type, int code, int value)
+{
+    struct input_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    write_events(&event, 1);
+}
+
+// add the difference between the deadline of an event and the time it was actually emitted to the histogram of its type
+void record_emit_error(delayed_event *event, uint64_t emitted)
+{
+    int class = event->type == EV_KEY ? error_key
+            : event->type == EV_REL ? error_rel
+            : event->type == EV_ABS ? error_abs
+            : error_other;
+
+    record_value(&emit_error[class], emitted > event->due ? emitted - event->due : 0);
+}
+
+// print percentiles of the emit error for each event type that occured
+void print_emit_errors()
+{
+    printf("emit error (us)      count       p50       p99     p99.9       max\n");
+
+    for(int i = 0; i < error_classes; i++)
+    {
+        histogram *h = &emit_error[i];
+        if(h->total == 0) continue;
+
+        printf("%-10s %15lu %9.1f %9.1f %9.1f %9.1f\n", error_class_names[i], (unsigned long)h->total,
+                histogram_percentile(h, 50) / 1000.0,
+                histogram_percentile(h, 99) / 1000.0,
+                histogram_percentile(h, 99.9) / 1000.0,
+                h->max / 1000.0);
+    }
+}
+
+// emit a list of due events to the virtual input device and return them to the pool
+// events of one frame are emitted back to back, the SYN_REPORT follows the last one
+// everything is collected into one buffer so a whole frame (or several frames sharing a deadline) costs one write()
+void emit_events(delayed_event *event)
+{
+    struct input_event batch[EMIT_BATCH_SIZE];
+    size_t used = 0;
+    uint64_t emitted = now_ns(); // same clock as the timestamps of input events
+
+    memset(batch, 0, sizeof(batch)); // the kernel sets the timestamps of uinput events itself
+
+    while(event)
+    {
+        if(used + 2 > EMIT_BATCH_SIZE)
+        {
+            write_events(batch, used);
+            used = 0;
+        }
+
+        batch[used].type = event->type;
+        batch[used].code = event->code;
+        batch[used].value = event->value;
+        used++;
+
+        // close the frame after its last event
+        if(event->syn)
         {
-            x = randn(mu, sigma);
+            batch[used].type = EV_SYN;
+            batch[used].code = SYN_REPORT;
+            batch[used].value = 0;
+            used++;
         }
-        return x;
+
+        log_event(event, emitted);
+        emitted_events++;
+        record_emit_error(event, emitted);
+
+        delayed_event *next = event->next;
+        release_event(&pool, event);
+        event = next;
+    }
+
+    write_events(batch, used);
+}
+
+// busy-wait until the deadline has passed, returns the current time
+uint64_t spin_until(uint64_t deadline)
+{
+    uint64_t start = now_ns();
+    uint64_t now = start;
+
+    while(now < deadline)
+    {
+        cpu_relax();
+        now = now_ns();
+    }
+
+    spin_count++;
+    spin_time += now - start;
+    return now;
+}
+
+// adjust the spin margin to how late the timer woke us up
+// the margin follows a larger overshoot right away and decays slowly towards the typical one,
+// so occasional late wakeups are covered without spinning longer than needed most of the time
+void tune_spin_margin(uint64_t overshoot)
+{
+    uint64_t target = overshoot + overshoot / 2; // some headroom
+
+    if(target > spin_margin) spin_margin = target;
+    else spin_margin -= (spin_margin - target) / 256;
+
+    if(spin_margin < SPIN_MARGIN_MIN) spin_margin = SPIN_MARGIN_MIN;
+    if(spin_margin > SPIN_MARGIN_MAX) spin_margin = SPIN_MARGIN_MAX;
+}
+
+// emit all pending events that are due and arm the timerfd to the next deadline
+// in precision mode a deadline closer than the spin margin is busy-waited for instead of slept for
+void dispatch_events()
+{
+    uint64_t now = now_ns();
+    uint64_t deadline = 0;
+
+    if(spin_mode && next_wheel_deadline(&pending, &deadline) && deadline > now && deadline - now <= spin_margin)
+    {
+        now = spin_until(deadline);
+    }
+
+    emit_events(expire_wheel(&pending, now));
+
+    if(!next_wheel_deadline(&pending, &deadline)) deadline = 0;
+    if(spin_mode && deadline > spin_margin) deadline -= spin_margin;
+    if(deadline == timer_deadline) return;
+
+    // a zero it_value disarms the timer
+    struct itimerspec timer = {0};
+    timer.it_value = ns_to_timespec(deadline);
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+    timer_deadline = deadline;
+}
+
+// delay configuration given by settings from the command line or the configuration file
+void args_config(struct arguments *a, delay_distribution *d, control_config *config)
+{
+    memset(config, 0, sizeof(control_config));
+    config->min_key_delay = a->min_key_delay;
+    config->max_key_delay = a->max_key_delay;
+    config->min_move_delay = a->min_move_delay;
+    config->max_move_delay = a->max_move_delay;
+    config->distribution = d->type;
+    config->mean = d->mean;
+    config->std = d->std;
+    config->mean2 = d->mean2;
+    config->std2 = d->std2;
+    config->weight = d->weight;
+}
+
+// copy the delay configuration the delay tables were built from
+void current_config(control_config *config)
+{
+    memset(config, 0, sizeof(control_config));
+    config->min_key_delay = min_delay_key;
+    config->max_key_delay = max_delay_key;
+    config->min_move_delay = min_delay_move;
+    config->max_move_delay = max_delay_move;
+    config->distribution = distribution.type;
+    config->mean = distribution.mean;
+    config->std = distribution.std;
+    config->mean2 = distribution.mean2;
+    config->std2 = distribution.std2;
+    config->weight = distribution.weight;
+}
+
+// copy the current delay configuration, with a control block the one that was published last
+// a configuration that was set but not applied yet counts as current, so successive commands build on each other
+void get_config(control_config *config)
+{
+    if(config_queued) *config = queued_config;
+    else if(control) read_config(control, config);
+    else current_config(config);
+}
+
+// switch to a new delay configuration and rebuild the delay tables that changed
+void apply_config(control_config *config)
+{
+    double key[2] = {min_delay_key, max_delay_key};
+    double move[2] = {min_delay_move, max_delay_move};
+
+    min_delay_key = config->min_key_delay;
+    max_delay_key = config->max_key_delay;
+    min_delay_move = config->min_move_delay;
+    max_delay_move = config->max_move_delay;
+
+    // make sure max >= min
+    if(max_delay_key < min_delay_key) max_delay_key = min_delay_key;
+    if(max_delay_move < min_delay_move) max_delay_move = min_delay_move;
+
+    // histograms and traces need a file, only parametric distributions can be switched to
+    distribution_type type = config->distribution < empirical ? config->distribution : distribution.type;
+    int reshaped = type != distribution.type || config->mean != distribution.mean || config->std != distribution.std
+        || config->mean2 != distribution.mean2 || config->std2 != distribution.std2 || config->weight != distribution.weight;
+
+    distribution.type = type;
+    distribution.mean = config->mean;
+    distribution.std = config->std;
+    distribution.mean2 = config->mean2;
+    distribution.std2 = config->std2;
+    distribution.weight = config->weight;
+
+    // the policies have their own ranges, they only depend on the distribution
+    if(reshaped) update_distributions();
+    if(!reshaped && (key[0] != min_delay_key || key[1] != max_delay_key))
+    {
+        build_range_table(&key_delays, &key_ramp, distribution.key_trace, min_delay_key, max_delay_key);
+    }
+    if(!reshaped && (move[0] != min_delay_move || move[1] != max_delay_move))
+    {
+        build_range_table(&move_delays, &move_ramp, distribution.move_trace, min_delay_move, max_delay_move);
     }
-    else return 0;
+
+    if(DEBUG) printf("set new values: %.3f %.3f %.3f %.3f\n", min_delay_key, max_delay_key, min_delay_move, max_delay_move);
 }
 
-// wait for some time, then emit an input event to a virtual input device
-void *invoke_delayed_event(void *args) 
-{ 
-    delayed_event *event = args;
+// delays must be finite and not negative, the distribution parameters finite
+// settings from the command line or the configuration file are checked with this as well
+int valid_delays(control_config *config)
+{
+    double values[] = {config->min_key_delay, config->max_key_delay, config->min_move_delay, config->max_move_delay};
+    double parameters[] = {config->mean, config->std, config->mean2, config->std2, config->weight};
+
+    for(int i = 0; i < 4; i++)
+    {
+        if(!isfinite(values[i]) || values[i] < 0) return 0;
+    }
+    for(int i = 0; i < 5; i++)
+    {
+        if(!isfinite(parameters[i])) return 0;
+    }
+    return 1;
+}
 
-    usleep(event->delay * 1000); // wait for the specified delay time (in milliseconds)
+// check a configuration from a command or a controller before any table is built from it
+// histograms and traces need a file, so only parametric distributions or the current one can be set
+int valid_config(control_config *config)
+{
+    if(config->distribution >= empirical && config->distribution != distribution.type) return 0;
 
-    int rc = libevdev_uinput_write_event(
-            uinput_dev, event->type,
-            event->code, event->value);
+    return valid_delays(config);
+}
 
-    if(rc != 0) printf("Failed to write uinput event: %s\n", strerror(-rc));
+// change the delay configuration
+// the change is only queued, so a burst of commands costs a single rebuild of the delay tables in update_config
+void set_config(control_config *config)
+{
+    queued_config = *config;
+    config_queued = 1;
+    config_blocked = 0;
+}
 
-    rc = libevdev_uinput_write_event(uinput_dev, EV_SYN, SYN_REPORT, 0);
+// use the configuration that was last published to the control block
+// a broken configuration from an external controller is skipped and the current one kept
+void sync_config()
+{
+    control_config config;
 
-    pthread_exit(NULL);
+    control_sequence = read_config(control, &config);
+    if(valid_config(&config)) apply_config(&config);
+    else if(DEBUG) printf("ignoring invalid configuration %lu from the control block\n", (unsigned long)control_sequence);
 }
 
-// thread to handle external modification of delay times using a FIFO
-void *handle_fifo(void *args)
+// apply the queued configuration and whatever controllers published, called once per pass through the event loop
+// with a control block the queued configuration is published there and picked up like the ones of external controllers,
+// if another writer holds the lock it stays queued for the next pass
+void update_config()
 {
-    char buffer[80];
+    if(config_queued && control == NULL) apply_config(&queued_config);
+    else if(config_queued) config_blocked = !publish_config(control, &queued_config);
+
+    if(!config_blocked) config_queued = 0;
+
+    if(control && control_changed(control, control_sequence)) sync_config();
+}
 
+// parse delay times, optionally followed by a distribution name and its parameters (mean std [mean2 std2 weight])
+// only set the delay times if all four values could be read correctly
+int handle_set_command(char *params, char *reply, size_t size)
+{
     // needed so we don't lose our old delay times in case something goes wrong
-    int buffer_min_delay_key, buffer_max_delay_key, buffer_min_delay_move, buffer_max_delay_move;
+    control_config config;
+    char name[16];
+    distribution_type type;
 
-    while(1)
+    get_config(&config);
+
+    int count = sscanf(params, "%lf %lf %lf %lf %15s %lf %lf %lf %lf %lf",
+            &config.min_key_delay, &config.max_key_delay, &config.min_move_delay, &config.max_move_delay,
+            name, &config.mean, &config.std, &config.mean2, &config.std2, &config.weight);
+
+    // optionally a distribution and its parameters follow the delay times
+    if(count >= 5 && !parse_distribution_type(name, &type))
+    {
+        snprintf(reply, size, "error unknown distribution %s", name);
+        return 0;
+    }
+    if(count >= 5) config.distribution = type;
+
+    if(count < 4)
+    {
+        snprintf(reply, size, "error bad data structure");
+        return 0;
+    }
+    if(!valid_config(&config))
+    {
+        snprintf(reply, size, "error bad values");
+        return 0;
+    }
+
+    set_config(&config);
+    snprintf(reply, size, "ok");
+    return 1;
+}
+
+// change only the distribution and its parameters, the delay times are kept
+int handle_dist_command(char *params, char *reply, size_t size)
+{
+    control_config config;
+    char name[16];
+    distribution_type type;
+
+    get_config(&config);
+
+    int count = sscanf(params, "%15s %lf %lf %lf %lf %lf", name, &config.mean, &config.std, &config.mean2, &config.std2, &config.weight);
+    if(count < 1 || !parse_distribution_type(name, &type))
+    {
+        snprintf(reply, size, "error unknown distribution %s", count < 1 ? "" : name);
+        return 0;
+    }
+
+    config.distribution = type;
+    if(!valid_config(&config))
+    {
+        snprintf(reply, size, "error bad values");
+        return 0;
+    }
+
+    set_config(&config);
+    snprintf(reply, size, "ok");
+    return 1;
+}
+
+// collect the counters reported by the stats command
+void get_stats(server_stats *stats)
+{
+    memset(stats, 0, sizeof(server_stats));
+    stats->emitted = emitted_events;
+    stats->pending = pool.used - frame_used;
+    stats->dropped = dropped_events;
+    stats->bypassed = bypassed_events;
+    stats->paused = paused;
+
+    for(int i = 0; i < error_classes; i++)
+    {
+        stats->error_p99[i] = histogram_percentile(&emit_error[i], 99);
+        stats->error_max[i] = emit_error[i].max;
+    }
+}
+
+// execute a text command from the control socket or the FIFO and write the reply
+// a message starting with a number is a set command, so FIFO messages work unchanged
+// returns 1 if the command succeeded
+int handle_text_command(char *message, char *reply, size_t size)
+{
+    char verb[16];
+    int offset = 0;
+
+    while(*message == ' ' || *message == '\t') message++;
+
+    if((*message >= '0' && *message <= '9') || *message == '.') return handle_set_command(message, reply, size);
+    if(sscanf(message, "%15s %n", verb, &offset) < 1)
+    {
+        snprintf(reply, size, "error empty command");
+        return 0;
+    }
+
+    char *params = message + offset;
+
+    if(strcmp(verb, "set") == 0) return handle_set_command(params, reply, size);
+    if(strcmp(verb, "dist") == 0) return handle_dist_command(params, reply, size);
+
+    if(strcmp(verb, "get") == 0)
     {
-        // open the FIFO - this call blocks the thread until someone writes to the FIFO
-        fifo_fd = open(fifo_path, O_RDONLY);
+        control_config config;
+        get_config(&config);
 
-        if(read(fifo_fd, buffer, 80) <= 0) continue; // read the FIFO's content into a buffer and skip setting the variables if an error occurs
+        snprintf(reply, size, "ok %.6f %.6f %.6f %.6f %s %g %g %g %g %g",
+                config.min_key_delay, config.max_key_delay, config.min_move_delay, config.max_move_delay,
+                distribution_name(config.distribution), config.mean, config.std, config.mean2, config.std2, config.weight);
+        return 1;
+    }
 
-        // parse new values from the FIFO
-        // only set the delay times if all four values could be read correctly
-        if(sscanf(buffer, "%d %d %d %d", &buffer_min_delay_key, &buffer_max_delay_key, &buffer_min_delay_move, &buffer_max_delay_move) == 4)
+    if(strcmp(verb, "stats") == 0)
+    {
+        server_stats stats;
+        get_stats(&stats);
+
+        int length = snprintf(reply, size, "ok emitted=%lu pending=%lu dropped=%lu bypassed=%lu paused=%u",
+                (unsigned long)stats.emitted, (unsigned long)stats.pending,
+                (unsigned long)stats.dropped, (unsigned long)stats.bypassed, stats.paused);
+
+        for(int i = 0; i < error_classes && length < (int)size; i++)
+        {
+            length += snprintf(reply + length, size - length, " %s_p99_us=%.1f %s_max_us=%.1f",
+                    error_class_names[i], stats.error_p99[i] / 1000.0, error_class_names[i], stats.error_max[i] / 1000.0);
+        }
+        return 1;
+    }
+
+    if(strcmp(verb, "policies") == 0)
+    {
+        char buffer[256];
+        const char *path = sscanf(params, "%255s", buffer) == 1 ? buffer : policy_path;
+
+        if(path == NULL || !reload_policies(path))
         {
-            // set delay times
-            min_delay_key = buffer_min_delay_key;
-            max_delay_key = buffer_max_delay_key;
-            min_delay_move = buffer_min_delay_move;
-            max_delay_move = buffer_max_delay_move;
+            snprintf(reply, size, "error could not load delay policies");
+            return 0;
+        }
+
+        snprintf(reply, size, "ok %d", policies->count - 1);
+        return 1;
+    }
+
+    if(strcmp(verb, "pause") == 0 || strcmp(verb, "resume") == 0)
+    {
+        paused = strcmp(verb, "pause") == 0;
+        snprintf(reply, size, "ok");
+        return 1;
+    }
+
+    snprintf(reply, size, "error unknown command %s", verb);
+    return 0;
+}
+
+// execute a binary command from the control socket and write the reply
+// returns the length of the reply
+size_t handle_binary_command(char *message, size_t length, char *reply)
+{
+    command_header *command = (command_header*)message;
+    reply_header *header = (reply_header*)reply;
+    char *payload = reply + sizeof(reply_header);
+
+    header->status = status_ok;
+    header->length = 0;
 
-            // make sure max >= min
-            if(max_delay_key < min_delay_key) max_delay_key = min_delay_key;
-            if(max_delay_move < min_delay_move) max_delay_move = min_delay_move;
+    if(length < sizeof(command_header))
+    {
+        header->status = status_bad_arguments;
+        return sizeof(reply_header);
+    }
 
-            if(DEBUG) printf("set new values: %d %d %d %d\n", min_delay_key, max_delay_key, min_delay_move, max_delay_move);
+    switch(command->command)
+    {
+    case command_set_config:
+        if(length < sizeof(command_header) + sizeof(control_config))
+        {
+            header->status = status_bad_arguments;
+            break;
         }
-        else
+        control_config config;
+        memcpy(&config, message + sizeof(command_header), sizeof(control_config));
+        if(valid_config(&config)) set_config(&config);
+        else header->status = status_bad_arguments;
+        break;
+    case command_get_config:
+        get_config((control_config*)payload);
+        header->length = sizeof(control_config);
+        break;
+    case command_get_stats:
+        get_stats((server_stats*)payload);
+        header->length = sizeof(server_stats);
+        break;
+    case command_reload_policies:
+        if(policy_path == NULL || !reload_policies(policy_path)) header->status = status_bad_arguments;
+        break;
+    case command_pause:
+    case command_resume:
+        paused = command->command == command_pause;
+        break;
+    default:
+        header->status = status_unknown_command;
+        break;
+    }
+
+    return sizeof(reply_header) + header->length;
+}
+
+// answer all commands a client has sent, it is disconnected when it closes the connection
+void handle_client(int fd)
+{
+    char message[SERVER_MESSAGE_SIZE + 1] __attribute__((aligned(8)));
+    char reply[SERVER_MESSAGE_SIZE] __attribute__((aligned(8)));
+    ssize_t length;
+
+    while((length = receive_message(fd, message, SERVER_MESSAGE_SIZE)) > 0)
+    {
+        if(is_binary_command(message, length))
+        {
+            send_reply(fd, reply, handle_binary_command(message, length, reply));
+            continue;
+        }
+
+        // text commands may end with a newline
+        message[length] = '\0';
+        if(message[length - 1] == '\n') message[length - 1] = '\0';
+
+        handle_text_command(message, reply, sizeof(reply));
+        send_reply(fd, reply, strlen(reply));
+    }
+
+    if(length == 0) close(fd); // also removes it from the epoll set
+}
+
+// register a file descriptor with the event loop
+int watch_fd(int fd)
+{
+    struct epoll_event watch = {0};
+    watch.events = EPOLLIN;
+    watch.data.fd = fd;
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &watch) == 0;
+}
+
+// accept all waiting clients and add them to the event loop
+void accept_clients()
+{
+    int fd;
+
+    while((fd = accept_client(server_fd)) >= 0)
+    {
+        if(!watch_fd(fd))
+        {
+            perror("Failed to watch control socket client");
+            close(fd);
+        }
+    }
+}
+
+// apply the delays the profile sets now and arm the profile timer to the next change
+void run_profile()
+{
+    uint64_t expirations;
+    control_config config;
+    double delays[4], from[4], to[4];
+
+    if(read(profile_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("Failed to read profile timer");
+
+    uint64_t next = evaluate_profile(profile, now_ns(), delays, from, to);
+
+    // the tables for the ends of a ramp are built when it starts, its steps only blend them
+    build_ramp(&key_ramp, distribution.key_trace, &from[0], &to[0], 0);
+    build_ramp(&move_ramp, distribution.move_trace, &from[2], &to[2], 0);
+
+    get_config(&config);
+    config.min_key_delay = delays[0];
+    config.max_key_delay = delays[1];
+    config.min_move_delay = delays[2];
+    config.max_move_delay = delays[3];
+    set_config(&config);
+
+    // a zero it_value disarms the timer once the profile is over
+    struct itimerspec timer = {0};
+    timer.it_value = ns_to_timespec(next);
+    timerfd_settime(profile_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+// parse a message from the FIFO, it uses the same text commands as the control socket but gets no reply
+void handle_fifo_message(char *message)
+{
+    char reply[SERVER_MESSAGE_SIZE];
+
+    if(!handle_text_command(message, reply, sizeof(reply)) && DEBUG) printf("could not execute FIFO command - %s\n", reply);
+}
+
+// open the read end of the FIFO without blocking and add it to the event loop
+// returns 0 if it can't be opened or watched
+int open_fifo()
+{
+    fifo_fd = open(fifo_path, O_RDONLY | O_NONBLOCK);
+    if(fifo_fd < 0) return 0;
+    if(epoll_fd >= 0 && !watch_fd(fifo_fd)) return 0;
+
+    return 1;
+}
+
+// read everything that was written to the FIFO
+// messages are separated by newlines, incomplete messages stay in the buffer until the rest arrives
+// or the last writer closes the FIFO, so every write without a newline is still a message of its own
+void handle_fifo()
+{
+    ssize_t length;
+
+    while((length = read(fifo_fd, fifo_buffer + fifo_buffer_used, sizeof(fifo_buffer) - fifo_buffer_used - 1)) != 0)
+    {
+        if(length < 0) return; // EAGAIN, the writer is still connected
+
+        fifo_buffer_used += length;
+        fifo_buffer[fifo_buffer_used] = '\0';
+
+        char *message = fifo_buffer;
+        char *end;
+        while((end = strchr(message, '\n')) != NULL)
         {
-            if(DEBUG) printf("could not set new delays - bad data structure\n");
+            *end = '\0';
+            handle_fifo_message(message);
+            message = end + 1;
         }
 
-        close(fifo_fd);
+        fifo_buffer_used -= message - fifo_buffer;
+        memmove(fifo_buffer, message, fifo_buffer_used);
+
+        // a message that does not fit into the buffer can't be valid
+        if(fifo_buffer_used == sizeof(fifo_buffer) - 1) fifo_buffer_used = 0;
+    }
+
+    // all writers are gone, whatever is left is the last message
+    if(fifo_buffer_used > 0)
+    {
+        fifo_buffer[fifo_buffer_used] = '\0';
+        handle_fifo_message(fifo_buffer);
+        fifo_buffer_used = 0;
     }
+
+    // the FIFO keeps reporting a hangup until it is opened again, closing it also removes it from the event loop
+    close(fifo_fd);
+    if(!open_fifo()) perror("Failed to reopen FIFO");
 }
 
 // create a FIFO for inter process communication at the path defined by the 6th command line parameter (recommended: somewhere in /tmp)
 // this can be used to adjust the delay values with an external program during runtime
 // simply write (or echo) four numbers (min_delay_key max_delay_key min_delay_move max_delay move) separated by whitespaces into the FIFO
+// delays are given in milliseconds and may have a fractional part
 int init_fifo()
 {
     unlink(fifo_path); // unlink the FIFO if it already exists
     umask(0); // needed for permissions, I have no idea what this exactly does
     if(mkfifo(fifo_path, 0666) == -1) return 0; // create the FIFO
 
-    // create a thread reading the FIFO and adjusting the delay times
-    pthread_create(&fifo_thread, NULL, handle_fifo, NULL); 
-
-    return 1;
+    // the FIFO is read from the event loop
+    return open_fifo();
 }
 
 // open the input device we want to "enhance" with delay
 int init_input_device()
 {
 	/* Open device. */
-	int fd_event = open(event_handle, O_RDONLY);
+	int fd_event = open(event_handle, O_RDONLY | O_NONBLOCK);
 	if (fd_event < 0)
     {
 		perror("Failed to open input device");
@@ -199,6 +1004,11 @@ int init_input_device()
 		exit(EXIT_FAILURE);
 	}
 
+    // delays are measured from the time the kernel saw the event, which needs to be on the same clock as the timer
+    // older kernels only report CLOCK_REALTIME, fall back to the time the event is read then
+    kernel_timestamps = libevdev_set_clock_id(event_dev, CLOCK_MONOTONIC) == 0;
+    if(!kernel_timestamps) printf("Warning, device does not support monotonic timestamps, delays are measured from the time events are read\n");
+
     return 1;
 }
 
@@ -221,33 +1031,173 @@ int init_virtual_input()
 		exit(EXIT_FAILURE);
 	}
 
+    // events are written to the uinput device directly so a whole frame can be written at once
+    uinput_fd = libevdev_uinput_get_fd(uinput_dev);
+
     return 1;
 }
 
+// pick the delay table of the current frame
+// the first event with a policy for its code decides, otherwise the frame uses the default policy of its class:
+// a frame containing any key event uses the key delay, all other frames use the move delay
+delay_table* frame_delay_table()
+{
+    int is_key = 0;
+    for(int i = 0; i < frame_used; i++)
+    {
+        if(frame[i]->type == EV_KEY) is_key = 1;
+    }
+
+    if(policies)
+    {
+        for(int i = 0; i < frame_used; i++)
+        {
+            int policy = code_policy(policies, frame[i]->type, frame[i]->code);
+            if(policy) return &policies->policies[policy].table;
+        }
+
+        int policy = policies->types[is_key ? EV_KEY : frame[0]->type];
+        if(policy) return &policies->policies[policy].table;
+    }
+
+    return is_key ? &key_delays : &move_delays;
+}
+
+// schedule all buffered events of the current frame with a single delay, counted from the time the frame ended
+// deadlines never decrease, so frames are emitted in the same order they were read
+void schedule_frame(uint64_t timestamp)
+{
+    if(bypassed_in_frame)
+    {
+        write_event(EV_SYN, SYN_REPORT, 0);
+        bypassed_in_frame = 0;
+    }
+
+    if(frame_used == 0) return;
+
+    // frames still go through the wheel while paused, so they can't overtake frames that are already pending
+    uint64_t due = paused ? timestamp : timestamp + sample_delay(&rng, frame_delay_table());
+
+    if(due < last_frame_due) due = last_frame_due;
+    last_frame_due = due;
+
+    for(int i = 0; i < frame_used; i++)
+    {
+        delayed_event *event = frame[i];
+        event->delay = due - event->timestamp;
+        event->due = due;
+        event->syn = i == frame_used - 1;
+
+        add_to_wheel(&pending, event); // the event is freed after it has been emitted
+    }
+
+    frame_used = 0;
+}
+
+// block until the earliest pending frame has been emitted and its slots are free again
+delayed_event* wait_for_event_slot()
+{
+    uint64_t deadline;
+    delayed_event *event = NULL;
+
+    while(event == NULL && next_wheel_deadline(&pending, &deadline))
+    {
+        struct timespec wakeup = ns_to_timespec(deadline);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+
+        dispatch_events();
+        event = acquire_event(&pool);
+    }
+
+    return event;
+}
+
+// buffer input events until the device reports the end of the frame with SYN_REPORT
+// note EV_SYN events are NOT delayed, a SYN_REPORT is generated after the last event of each delayed frame
+void handle_input_event(struct input_event *inputEvent)
+{
+    // the kernel only reports microseconds
+    uint64_t timestamp = kernel_timestamps
+            ? (uint64_t)inputEvent->time.tv_sec * NSEC_PER_SEC + (uint64_t)inputEvent->time.tv_usec * 1000
+            : now_ns();
+
+    if(inputEvent->type == EV_SYN)
+    {
+        if(inputEvent->code == SYN_REPORT) schedule_frame(timestamp);
+        return;
+    }
+    if(inputEvent->type == EV_MSC) return;
+
+    delayed_event *event = acquire_event(&pool);
+
+    // all slots are pending, apply the configured policy
+    if(event == NULL && pool_policy == pool_block) event = wait_for_event_slot();
+    if(event == NULL)
+    {
+        if(pool_policy == pool_bypass)
+        {
+            write_event(inputEvent->type, inputEvent->code, inputEvent->value);
+            bypassed_in_frame = 1;
+            bypassed_events++;
+        }
+        else dropped_events++;
+        return;
+    }
+
+    event->type = inputEvent->type;
+    event->code = inputEvent->code;
+    event->value = inputEvent->value;
+    event->timestamp = timestamp;
+
+    frame[frame_used++] = event;
+
+    // should never happen with real devices, but don't let a missing SYN_REPORT overflow the buffer
+    if(frame_used == FRAME_SIZE) schedule_frame(timestamp);
+}
+
+// drop the events buffered for the current frame
+void discard_frame()
+{
+    for(int i = 0; i < frame_used; i++) release_event(&pool, frame[i]);
+    frame_used = 0;
+}
+
+// pass on the events libevdev generates to bring the device state up to date after SYN_DROPPED
+// the incomplete frame that was buffered when events got lost is thrown away
+void sync_device()
+{
+    struct input_event event;
+    int rc = LIBEVDEV_READ_STATUS_SYNC;
+
+    discard_frame();
+
+    while (rc == LIBEVDEV_READ_STATUS_SYNC)
+    {
+        rc = libevdev_next_event(event_dev,
+                LIBEVDEV_READ_FLAG_SYNC, &event);
+        if (rc == LIBEVDEV_READ_STATUS_SYNC) handle_input_event(&event);
+    }
+}
+
 // get the next input event from libevdev
+// returns 0 if there are no more events to read at the moment
 int get_event(struct input_event *event)
 {
-    struct timeval current_time;
-	gettimeofday(&current_time, NULL);
-
 	int rc = LIBEVDEV_READ_STATUS_SUCCESS;
 
-    rc = libevdev_next_event(event_dev,
-                    LIBEVDEV_READ_FLAG_NORMAL |
-                    LIBEVDEV_READ_FLAG_BLOCKING, event);
+    rc = libevdev_next_event(event_dev, LIBEVDEV_READ_FLAG_NORMAL, event);
 
     /* Handle dropped SYN. */
     if (rc == LIBEVDEV_READ_STATUS_SYNC)
     {
         printf("Warning, syn dropped: (%d) %s\n", -rc, strerror(-rc));
 
-        while (rc == LIBEVDEV_READ_STATUS_SYNC)
-        {
-            rc = libevdev_next_event(event_dev,
-                    LIBEVDEV_READ_FLAG_SYNC, event);
-        }
+        sync_device();
+        rc = libevdev_next_event(event_dev, LIBEVDEV_READ_FLAG_NORMAL, event);
     }
 
+    if (rc == -EAGAIN) return 0;
+
 	if (rc == -ENODEV)
     {
 		printf("Device disconnected: (%d) %s\n", -rc, strerror(-rc));
@@ -256,33 +1206,419 @@ int get_event(struct input_event *event)
     return 1;
 }
 
-// make sure to clean up when the program ends
+// read pending input events straight from the device fd, up to read_batch events per read()
+// libevdev is bypassed, but its copy of the device state is kept up to date
+// so it can take over and resync the device if the kernel reports SYN_DROPPED
+// returns -1 if the device is gone
+int read_device()
+{
+    struct input_event buffer[MAX_READ_BATCH];
+    int device_fd = libevdev_get_fd(event_dev);
+
+    while(1)
+    {
+        ssize_t length = read(device_fd, buffer, read_batch * sizeof(struct input_event));
+
+        if(length < 0 && errno == EAGAIN) return 0;
+        if(length < 0)
+        {
+            printf("Device disconnected: (%d) %s\n", errno, strerror(errno));
+            return -1;
+        }
+
+        int count = length / sizeof(struct input_event);
+        read_calls++;
+        read_events += count;
+        if(count > max_read_events) max_read_events = count;
+
+        for(int i = 0; i < count; i++)
+        {
+            struct input_event *event = &buffer[i];
+
+            if(event->type == EV_SYN && event->code == SYN_DROPPED)
+            {
+                printf("Warning, syn dropped\n");
+
+                // libevdev drains the remaining events and reports what changed in the meantime
+                libevdev_next_event(event_dev, LIBEVDEV_READ_FLAG_FORCE_SYNC, event);
+                sync_device();
+                break;
+            }
+
+            if(event->type == EV_KEY || event->type == EV_ABS || event->type == EV_SW || event->type == EV_LED)
+            {
+                libevdev_set_event_value(event_dev, event->type, event->code, event->value);
+            }
+
+            handle_input_event(event);
+        }
+
+        if(count < read_batch) return 0;
+    }
+}
+
+// set up the event loop and the timerfd used for dispatching delayed events
+int init_event_loop()
+{
+    epoll_fd = epoll_create1(0);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if(epoll_fd < 0 || timer_fd < 0) return 0;
+
+    // the kernel may postpone timer expirations by up to 50 us by default to coalesce wakeups
+    if(prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0) < 0) perror("Failed to set timer slack");
+
+    init_wheel(&pending, tick_length, now_ns());
+
+    if(!watch_fd(libevdev_get_fd(event_dev))) return 0;
+    if(!watch_fd(timer_fd)) return 0;
+    if(fifo_fd >= 0 && !watch_fd(fifo_fd)) return 0;
+    if(server_fd >= 0 && !watch_fd(server_fd)) return 0;
+    if(config_fd >= 0 && !watch_fd(config_fd)) return 0;
+
+    if(profile != NULL)
+    {
+        profile_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if(profile_fd < 0 || !watch_fd(profile_fd)) return 0;
+    }
+
+    return 1;
+}
+
+// default values of all settings
+void default_args(struct arguments *a)
+{
+    memset(a, 0, sizeof(struct arguments));
+    a->distribution = "";
+    a->weight = 0.5;
+    a->tick = 10;
+    a->spin = -1;
+    a->pool_size = 4096;
+    a->pool_policy = "";
+    a->log_segment = 64;
+    a->cpu = -1;
+    a->log_cpu = -1;
+}
+
+// apply the settings that don't need any setup and can be changed while running
+void apply_runtime_args(struct arguments *a)
+{
+    spin_mode = a->spin >= 0;
+    spin_auto = a->spin == 0;
+    if(a->spin > 0) spin_margin = (uint64_t)a->spin * 1000;
+    read_batch = a->read_batch;
+    if(read_batch > MAX_READ_BATCH) read_batch = MAX_READ_BATCH;
+    if(strcmp(a->pool_policy, "drop") == 0) pool_policy = pool_drop;
+    else if(strcmp(a->pool_policy, "bypass") == 0) pool_policy = pool_bypass;
+    else pool_policy = pool_block;
+    DEBUG = a->verbose;
+}
+
+static int changed(const char *a, const char *b)
+{
+    if(a == NULL || b == NULL) return a != b;
+    return strcmp(a, b) != 0;
+}
+
+// point out settings of a reloaded configuration that only take effect after a restart
+void warn_restart_only(struct arguments *a)
+{
+    if(changed(a->device_file, args.device_file)) printf("input can only be changed by restarting\n");
+    if(changed(a->fifo_path, args.fifo_path)) printf("fifo can only be changed by restarting\n");
+    if(changed(a->socket_path, args.socket_path)) printf("socket can only be changed by restarting\n");
+    if(changed(a->shm_name, args.shm_name)) printf("shm can only be changed by restarting\n");
+    if(changed(a->profile_path, args.profile_path)) printf("profile can only be changed by restarting\n");
+    if(a->tick != args.tick) printf("tick can only be changed by restarting\n");
+    if(a->pool_size != args.pool_size) printf("pool_size can only be changed by restarting\n");
+    if(a->log_segment != args.log_segment) printf("log_segment can only be changed by restarting\n");
+    if(a->priority != args.priority || a->cpu != args.cpu || a->log_cpu != args.log_cpu || a->lock_memory != args.lock_memory)
+    {
+        printf("scheduling settings can only be changed by restarting\n");
+    }
+}
+
+// read the configuration file again and switch to its settings
+// everything that can fail (parsing, loading histograms, traces and policies) happens before anything is changed,
+// so a broken file leaves the running configuration alone
+// pending events keep their deadlines, only frames read after the reload get the new delays
+void reload_config()
+{
+    struct arguments loaded;
+    delay_distribution loaded_distribution;
+    policy_table *loaded_policies = NULL;
+
+    default_args(&loaded);
+    if(parse_args(config_argc, config_argv, &loaded, ARGP_NO_EXIT | ARGP_SILENT) != 0
+    || !load_distribution(&loaded, &loaded_distribution))
+    {
+        printf("Failed to reload %s, keeping the current configuration\n", args.config_path);
+        free(loaded.config_data);
+        return;
+    }
+
+    control_config config;
+    args_config(&loaded, &loaded_distribution, &config);
+    if(!valid_delays(&config))
+    {
+        printf("Invalid delays in %s, keeping the current configuration\n", args.config_path);
+        free_distribution(&loaded_distribution);
+        free(loaded.config_data);
+        return;
+    }
+
+    if(loaded.policy_path != NULL && (loaded_policies = load_policies(loaded.policy_path)) == NULL)
+    {
+        printf("Failed to load delay policies from %s, keeping the current configuration\n", loaded.policy_path);
+        free_distribution(&loaded_distribution);
+        free(loaded.config_data);
+        return;
+    }
+
+    warn_restart_only(&loaded);
+    apply_runtime_args(&loaded);
+
+    delay_distribution old_distribution = distribution;
+    distribution = loaded_distribution;
+    min_delay_key = loaded.min_key_delay;
+    max_delay_key = loaded.max_key_delay < loaded.min_key_delay ? loaded.min_key_delay : loaded.max_key_delay;
+    min_delay_move = loaded.min_move_delay;
+    max_delay_move = loaded.max_move_delay < loaded.min_move_delay ? loaded.min_move_delay : loaded.max_move_delay;
+
+    free_policies(policies);
+    policies = loaded_policies;
+    free(policy_path);
+    policy_path = loaded.policy_path ? strdup(loaded.policy_path) : NULL;
+
+    // the tables must not refer to the old histogram or traces anymore before they are freed
+    update_distributions();
+    free_distribution(&old_distribution);
+
+    // controllers see the new configuration as well, a configuration a command queued before the reload is dropped
+    config_queued = 0;
+    if(control)
+    {
+        current_config(&config);
+        set_config(&config);
+    }
+
+    free(loaded.config_data);
+    if(DEBUG) printf("reloaded %s\n", args.config_path);
+}
+
+// wait for new input events, FIFO messages and due events until the program is interrupted
+// no threads are involved, every wakeup handles whatever became ready and then dispatches all due events
+int run_event_loop()
+{
+    struct epoll_event ready[8];
+    struct input_event inputEvent;
+    int device_fd = libevdev_get_fd(event_dev);
+
+    while(running)
+    {
+        if(report_requested)
+        {
+            print_emit_errors();
+            report_requested = 0;
+        }
+        if(reload_requested && policy_path != NULL)
+        {
+            if(!reload_policies(policy_path)) printf("Failed to reload delay policies from %s\n", policy_path);
+            reload_requested = 0;
+        }
+
+        // a queued configuration is applied right away by the next pass, one that waits for the lock is retried every millisecond
+        int count = epoll_wait(epoll_fd, ready, 8, !config_queued ? -1 : config_blocked ? 1 : 0);
+        if(count < 0)
+        {
+            if(errno == EINTR) continue;
+            perror("Failed to wait for events");
+            return 0;
+        }
+
+        // frames read in this pass are delayed with the configuration that was current when it started
+        update_config();
+
+        for(int i = 0; i < count; i++)
+        {
+            int fd = ready[i].data.fd;
+
+            if(fd == device_fd)
+            {
+                int err;
+                if(read_batch > 0) err = read_device();
+                else while((err = get_event(&inputEvent)) > 0) handle_input_event(&inputEvent);
+                if(err < 0) return 0;
+            }
+            else if(fd == fifo_fd)
+            {
+                handle_fifo();
+            }
+            else if(fd == config_fd)
+            {
+                if(config_changed(config_fd, args.config_path)) reload_config();
+            }
+            else if(fd == profile_fd)
+            {
+                run_profile();
+            }
+            else if(fd == server_fd)
+            {
+                accept_clients();
+            }
+            else if(fd == timer_fd)
+            {
+                uint64_t expirations;
+                if(read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("Failed to read timer");
+
+                uint64_t now = now_ns();
+                if(spin_auto && timer_deadline > 0 && now > timer_deadline) tune_spin_margin(now - timer_deadline);
+            }
+            else
+            {
+                handle_client(fd);
+            }
+        }
+
+        dispatch_events();
+    }
+
+    return 1;
+}
+
+// watch the configuration file for changes, they are picked up by the event loop
+int init_config_watch()
+{
+    config_fd = watch_config(args.config_path);
+    if(config_fd < 0)
+    {
+        perror("Failed to watch configuration file");
+        exit(EXIT_FAILURE);
+    }
+
+    return 1;
+}
+
+// create the control socket, clients are accepted by the event loop
+int init_server()
+{
+    server_fd = open_server(socket_path);
+    if(server_fd < 0)
+    {
+        perror("Failed to create control socket");
+        exit(EXIT_FAILURE);
+    }
+
+    return 1;
+}
+
+// create the shared memory control block and publish the configuration given on the command line
+int init_control()
+{
+    if(control_name == NULL || control_name[0] == '\0') return 1;
+
+    control_config config;
+    get_config(&config);
+
+    control = open_control_block(control_name, &config);
+    if(control == NULL)
+    {
+        perror("Failed to create shared memory control block");
+        exit(EXIT_FAILURE);
+    }
+
+    control_sequence = 0;
+    return 1;
+}
+
+// apply the scheduling options to the event loop and the log writer
+// this happens after everything has been allocated, so locking memory faults in the pool and the log buffer as well
+int init_realtime()
+{
+    if(args.log_cpu >= 0 && !pin_event_log(args.log_cpu))
+    {
+        perror("Failed to pin event log writer");
+        exit(EXIT_FAILURE);
+    }
+
+    if(args.cpu >= 0 && !pin_thread(pthread_self(), args.cpu))
+    {
+        perror("Failed to pin event loop");
+        exit(EXIT_FAILURE);
+    }
+
+    if(args.lock_memory && !lock_memory())
+    {
+        perror("Failed to lock memory");
+        exit(EXIT_FAILURE);
+    }
+
+    if(args.priority > 0 && !set_realtime_priority(args.priority))
+    {
+        perror("Failed to set real-time priority");
+        exit(EXIT_FAILURE);
+    }
+
+    return 1;
+}
+
+// stop the event loop when the program is interrupted
 void onExit(int signum)
+{
+    running = 0;
+}
+
+// print the emit error statistics from the event loop
+void onReport(int signum)
+{
+    report_requested = 1;
+}
+
+// reload the delay policies from the event loop
+void onReload(int signum)
+{
+    reload_requested = 1;
+}
+
+// make sure to clean up when the program ends
+void cleanup()
 {
     printf("\n");
-    write_event_log(&ev);
+    close_event_log();
+    print_emit_errors();
 
-    // end inter process communication
-    pthread_cancel(fifo_thread);
-    unlink(fifo_path);
+    if(dropped_events > 0 || bypassed_events > 0)
+    {
+        printf("event pool exhausted: %lu events dropped, %lu events passed on without delay\n", dropped_events, bypassed_events);
+    }
 
-    exit(EXIT_SUCCESS);
+    if(spin_count > 0 && DEBUG)
+    {
+        printf("busy-waited %lu times for %.1f us on average, spin margin %.1f us\n",
+                spin_count, (double)spin_time / spin_count / 1000, (double)spin_margin / 1000);
+    }
+
+    if(read_calls > 0)
+    {
+        printf("read %lu events in %lu reads (%.2f events per read, max %d)\n",
+                read_events, read_calls, (double)read_events / read_calls, max_read_events);
+    }
+
+    // end inter process communication
+    close_server(server_fd, socket_path);
+    close_control_block(control, control_name);
+    if(fifo_path != NULL && fifo_path[0] != '\0') unlink(fifo_path);
 }
 
 int main(int argc, char* argv[]) 
 {
     signal(SIGINT, onExit);
-    // defaults
-	args.device_file = NULL;
-    args.min_key_delay = 0;
-    args.max_key_delay = 0;
-    args.min_move_delay = 0;
-    args.max_move_delay = 0;
-    args.fifo_path = NULL;
-    args.distribution = "";
-
-	if (parse_args(argc, argv, &args) < 0) {
-		perror("Failed to parse arguments");
+    signal(SIGUSR1, onReport);
+    signal(SIGHUP, onReload);
+    default_args(&args);
+    config_argc = argc;
+    config_argv = argv;
+
+	if (parse_args(argc, argv, &args, 0) != 0) {
+		printf("Failed to parse arguments\n");
 		exit(EXIT_FAILURE);
 	}
 
@@ -292,62 +1628,88 @@ int main(int argc, char* argv[])
     max_delay_key = args.max_key_delay;
     min_delay_move = args.min_move_delay;
     max_delay_move = args.max_move_delay;
-    mu = args.mean;
-    sigma = args.std;
-    if(strcmp(args.distribution, "normal") == 0) distribution = normal;
-    else distribution = linear;
+    if(!load_distribution(&args, &distribution)) exit(EXIT_FAILURE);
+
+    control_config config;
+    args_config(&args, &distribution, &config);
+    if(!valid_delays(&config))
+    {
+        printf("Delays must be finite and not negative\n");
+        exit(EXIT_FAILURE);
+    }
     if(args.fifo_path) fifo_path = args.fifo_path;
-    DEBUG = args.verbose;
+    control_name = args.shm_name;
+    socket_path = args.socket_path;
+    if(args.policy_path != NULL)
+    {
+        policy_path = strdup(args.policy_path);
+        policies = load_policies(policy_path);
+        if(policies == NULL)
+        {
+            printf("Failed to load delay policies from %s\n", policy_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(args.profile_path != NULL)
+    {
+        profile = load_profile(args.profile_path);
+        if(profile == NULL)
+        {
+            printf("Failed to load delay profile from %s\n", args.profile_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(args.tick > 0) tick_length = (uint64_t)args.tick * 1000;
+    if(args.log_segment <= 0) args.log_segment = 64;
+    if(args.pool_size > 0) pool_size = args.pool_size;
+    if(pool_size < 2 * FRAME_SIZE) pool_size = 2 * FRAME_SIZE; // a full frame must always fit
+    apply_runtime_args(&args);
 
     // prevents Keydown events for KEY_Enter from never being released when grabbing the input device
     // after running the program in a terminal by pressing Enter
     // https://stackoverflow.com/questions/41995349
     sleep(1);
 
-    init_vector(&ev, 10);
+    if(!init_event_log(LOG_BUFFER_SIZE, (size_t)args.log_segment * 1024 * 1024 / sizeof(log_record)))
+    {
+        perror("Failed to open event log");
+        exit(EXIT_FAILURE);
+    }
+    init_pool(&pool, pool_size);
     if(!init_input_device()) return 1;
     if(!init_virtual_input()) return 1;
     if(fifo_path != NULL && fifo_path[0] != '\0')
     {
         if(!init_fifo()) return 1;
     }
+    if(socket_path != NULL && !init_server()) return 1;
+    if(args.config_path != NULL && !init_config_watch()) return 1;
+    if(!init_event_loop()) return 1;
+    if(!init_realtime()) return 1;
 
-    if(distribution==normal && DEBUG) printf("Normal distribution: mean: %lf, std: %lf\n", mu, sigma);
-
-    if(DEBUG) printf("key delay: %d - %d\nmove delay: %d - %d\n", min_delay_key, max_delay_key, min_delay_move, max_delay_move);
-
-    srand(time(0));
+    if(distribution.type != linear && distribution.type != empirical && DEBUG)
+    {
+        printf("%s distribution: mean: %lf, std: %lf\n", distribution_name(distribution.type), distribution.mean, distribution.std);
+    }
+    if(distribution.type == empirical && DEBUG) printf("Empirical distribution: %d buckets\n", distribution.histogram->size);
 
-    pthread_attr_setdetachstate(&invoked_event_thread_attr, PTHREAD_CREATE_DETACHED);
-    pthread_attr_setdetachstate(&log_delay_val_thread_attr, PTHREAD_CREATE_DETACHED);
+    if(DEBUG) printf("key delay: %.3f - %.3f\nmove delay: %.3f - %.3f\n", min_delay_key, max_delay_key, min_delay_move, max_delay_move);
 
-    // wait for new input events of the actual device
-    // when new event arrives, generate a delay value and create a thread waiting for this delay time
-    // the thread then generates an input event for a virtual input device
-    // note EV_SYN events are NOT delayed, they are automatically generated when the delayed event is executed
-    struct input_event inputEvent;
-    int err = -1;
-
-    while(1)
+    seed = args.seed_set ? args.seed : random_seed();
+    seed_rng(&rng, seed);
+    update_distributions();
+    if(!init_control()) return 1;
+    if(profile != NULL)
     {
-        err = get_event(&inputEvent);
-        if(err > -1 && inputEvent.type != EV_SYN && inputEvent.type != EV_MSC)
-		{
-            delayed_event *event = malloc(sizeof(delayed_event));
-            event->type = inputEvent.type;
-            event->code = inputEvent.code;
-            event->value = inputEvent.value;
+        // the profile starts now, its first delays replace the ones from the command line
+        profile->start = now_ns();
+        run_profile();
+    }
+    if(DEBUG) printf("seed: %lu\n", (unsigned long)seed);
 
-            if(inputEvent.type == EV_KEY) event->delay = calculate_delay(min_delay_key, max_delay_key);
-            else if(inputEvent.type == EV_REL) event->delay = calculate_delay(min_delay_move, max_delay_move);
+    int rc = run_event_loop();
 
-            pthread_t delayed_event_thread; 
-            pthread_create(&delayed_event_thread, &invoked_event_thread_attr, invoke_delayed_event, event);
+    cleanup();
 
-            event->timestamp = inputEvent.time.tv_sec * 1000 + inputEvent.time.tv_usec / 1000;
-            append_to_vector(&ev, *event);
-        }
-    }
-    
-    return 0;
-}
+    return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "policy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libevdev/libevdev.h>
+
+// assign a policy to an event type (EV_KEY, EV_REL, ...) or a single code (KEY_W, BTN_LEFT, REL_WHEEL, ABS_X, ...)
+// returns 0 if the name is unknown
+static int assign_policy(policy_table *table, const char *name, int policy)
+{
+    if(strncmp(name, "EV_", 3) == 0)
+    {
+        int type = libevdev_event_type_from_name(name);
+        if(type < 0 || type >= EV_CNT) return 0;
+
+        table->types[type] = policy;
+        return 1;
+    }
+
+    int type;
+    if(strncmp(name, "KEY_", 4) == 0 || strncmp(name, "BTN_", 4) == 0) type = EV_KEY;
+    else if(strncmp(name, "REL_", 4) == 0) type = EV_REL;
+    else if(strncmp(name, "ABS_", 4) == 0) type = EV_ABS;
+    else return 0;
+
+    int slot = policy_slot(type, libevdev_event_code_from_name(type, name));
+    if(slot < 0) return 0;
+
+    table->codes[slot] = policy;
+    return 1;
+}
+
+// load delay policies from a text file
+// every line contains one or more event codes or types separated by ',' followed by the min and max delay in milliseconds
+// e.g. "KEY_W,KEY_A,KEY_S,KEY_D 20 30" or "EV_REL 5 5", later lines override earlier ones
+// empty lines and lines starting with '#' are ignored
+// returns NULL if the file can't be read, contains a malformed line, an invalid delay, an unknown name or too many policies
+policy_table* load_policies(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(file == NULL) return NULL;
+
+    policy_table *table = calloc(1, sizeof(policy_table));
+    int capacity = 8;
+    char line[512];
+
+    table->policies = malloc(capacity * sizeof(delay_policy));
+    table->count = 1;
+
+    for(int number = 1; fgets(line, sizeof(line), file); number++)
+    {
+        char names[400];
+        double min, max;
+        int end = 0;
+
+        if(line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+
+        // names must not contain spaces, so "KEY_W, KEY_A 20 30" is rejected instead of being half applied
+        if(sscanf(line, "%399s %lf %lf %n", names, &min, &max, &end) != 3 || line[end] != '\0')
+        {
+            printf("Malformed delay policy in %s:%d\n", path, number);
+            fclose(file);
+            free_policies(table);
+            return NULL;
+        }
+
+        if(!isfinite(min) || !isfinite(max) || min < 0 || max < 0)
+        {
+            printf("Delays must be finite and not negative in %s:%d\n", path, number);
+            fclose(file);
+            free_policies(table);
+            return NULL;
+        }
+
+        if(table->count > MAX_POLICIES)
+        {
+            printf("Too many delay policies in %s, at most %d are supported\n", path, MAX_POLICIES);
+            fclose(file);
+            free_policies(table);
+            return NULL;
+        }
+
+        if(table->count == capacity)
+        {
+            capacity *= 2;
+            table->policies = realloc(table->policies, capacity * sizeof(delay_policy));
+        }
+
+        delay_policy *policy = &table->policies[table->count];
+        policy->min_delay = min;
+        policy->max_delay = max > min ? max : min;
+
+        for(char *name = strtok(names, ","); name; name = strtok(NULL, ","))
+        {
+            if(!assign_policy(table, name, table->count))
+            {
+                printf("Unknown event code %s in %s:%d\n", name, path, number);
+                fclose(file);
+                free_policies(table);
+                return NULL;
+            }
+        }
+        table->count++;
+    }
+    fclose(file);
+
+    return table;
+}
+
+void free_policies(policy_table *table)
+{
+    if(table == NULL) return;
+
+    free(table->policies);
+    free(table);
+}
+
+// build the delay table of every policy for the given distribution
+// needs to be called whenever the distribution changes
+void build_policy_tables(policy_table *table, delay_distribution *distribution, delay_trace *recording)
+{
+    for(int i = 1; i < table->count; i++)
+    {
+        delay_policy *policy = &table->policies[i];
+        build_delay_table(&policy->table, distribution, recording, policy->min_delay, policy->max_delay);
+    }
+}
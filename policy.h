@@ -0,0 +1,48 @@
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+#include <stdint.h>
+#include <linux/input.h>
+#include "distribution.h"
+
+// delay policies for single event codes and whole event types
+// every key code, relative and absolute axis has a slot in one flat table, so finding the policy of an event is one lookup
+#define POLICY_CODES (KEY_CNT + REL_CNT + ABS_CNT)
+#define MAX_POLICIES 255
+
+typedef struct
+{
+    double min_delay;           // milliseconds
+    double max_delay;
+    delay_table table;
+} delay_policy;
+
+typedef struct
+{
+    uint8_t codes[POLICY_CODES];    // policy of each key code and axis, 0 if it has none
+    uint8_t types[EV_CNT];          // default policy of each event type, 0 if it has none
+    int count;
+    delay_policy *policies;         // policies[0] is unused
+} policy_table;
+
+policy_table* load_policies(const char *path);
+void free_policies(policy_table *table);
+void build_policy_tables(policy_table *table, delay_distribution *distribution, delay_trace *recording);
+
+// slot of an event code in the flat table, -1 for event types without per-code policies
+static inline int policy_slot(int type, int code)
+{
+    if(type == EV_KEY && code >= 0 && code < KEY_CNT) return code;
+    if(type == EV_REL && code >= 0 && code < REL_CNT) return KEY_CNT + code;
+    if(type == EV_ABS && code >= 0 && code < ABS_CNT) return KEY_CNT + REL_CNT + code;
+    return -1;
+}
+
+// policy set for this event code, 0 if there is none
+static inline int code_policy(policy_table *table, int type, int code)
+{
+    int slot = policy_slot(type, code);
+    return slot < 0 ? 0 : table->codes[slot];
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "pool.h"
+
+void init_pool(event_pool *p, size_t size)
+{
+    p->slots = calloc(size, sizeof(delayed_event));
+    p->size = size;
+    p->used = 0;
+    p->free_list = NULL;
+
+    // chain the slots in reverse so they are handed out in memory order
+    for(size_t i = size; i > 0; i--)
+    {
+        p->slots[i - 1].next = p->free_list;
+        p->free_list = &p->slots[i - 1];
+    }
+}
+
+// returns NULL if all slots are in use
+delayed_event* acquire_event(event_pool *p)
+{
+    delayed_event *event = p->free_list;
+    if(event == NULL) return NULL;
+
+    p->free_list = event->next;
+    p->used++;
+
+    return event;
+}
+
+void release_event(event_pool *p, delayed_event *event)
+{
+    event->next = p->free_list;
+    p->free_list = event;
+    p->used--;
+}
+
+void free_pool(event_pool *p)
+{
+    free(p->slots);
+    p->slots = NULL;
+    p->free_list = NULL;
+    p->size = p->used = 0;
+}
@@ -0,0 +1,21 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include "log.h"
+
+// fixed-capacity pool of delayed events
+// all slots are allocated up front, free slots are chained through their next pointer
+typedef struct
+{
+    size_t size;
+    size_t used;
+    delayed_event* slots;
+    delayed_event* free_list;
+} event_pool;
+
+void init_pool(event_pool *p, size_t size);
+delayed_event* acquire_event(event_pool *p);
+void release_event(event_pool *p, delayed_event *event);
+void free_pool(event_pool *p);
+
+#endif
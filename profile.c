@@ -0,0 +1,125 @@
+#include "profile.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// load a delay profile from a text file
+// every line contains a time offset in seconds, the four delays in milliseconds and optionally step (default) or ramp
+// a line "loop [PERIOD]" repeats the profile every PERIOD seconds (default: the offset of the last point)
+// empty lines and lines starting with '#' are ignored
+// returns NULL if the file can't be read, contains no points or the offsets decrease
+delay_profile* load_profile(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(file == NULL) return NULL;
+
+    delay_profile *profile = calloc(1, sizeof(delay_profile));
+    int capacity = 16;
+    double period = 0;
+    char line[256];
+
+    profile->points = malloc(capacity * sizeof(profile_point));
+
+    while(fgets(line, sizeof(line), file))
+    {
+        double offset;
+        char mode[16] = "step";
+        profile_point point;
+
+        if(line[0] == '#') continue;
+
+        if(strncmp(line, "loop", 4) == 0)
+        {
+            profile->loop = 1;
+            sscanf(line + 4, "%lf", &period);
+            continue;
+        }
+
+        if(sscanf(line, "%lf %lf %lf %lf %lf %15s", &offset, &point.delays[0], &point.delays[1], &point.delays[2], &point.delays[3], mode) < 5) continue;
+
+        point.offset = offset > 0 ? offset * NSEC_PER_SEC + 0.5 : 0;
+        point.mode = strcmp(mode, "ramp") == 0 ? profile_ramp : profile_step;
+
+        if(profile->count > 0 && point.offset < profile->points[profile->count - 1].offset)
+        {
+            fclose(file);
+            free_profile(profile);
+            return NULL;
+        }
+
+        if(profile->count == capacity)
+        {
+            capacity *= 2;
+            profile->points = realloc(profile->points, capacity * sizeof(profile_point));
+        }
+        profile->points[profile->count++] = point;
+    }
+    fclose(file);
+
+    if(profile->count == 0)
+    {
+        free_profile(profile);
+        return NULL;
+    }
+
+    profile->period = period > 0 ? period * NSEC_PER_SEC + 0.5 : profile->points[profile->count - 1].offset;
+    if(profile->period == 0) profile->loop = 0; // nothing to repeat
+
+    return profile;
+}
+
+void free_profile(delay_profile *profile)
+{
+    if(profile == NULL) return;
+
+    free(profile->points);
+    free(profile);
+}
+
+// get the delays the profile sets at the given time
+// before the first point its delays apply, after the last point (without loop) the last delays are kept
+// from and to get the delays at both ends of a ramp in progress, so tables for them can be built once per ramp,
+// otherwise both are the current delays
+// returns the time the delays change next or 0 if they won't change anymore
+uint64_t evaluate_profile(delay_profile *profile, uint64_t now, double *delays, double *from, double *to)
+{
+    uint64_t elapsed = now > profile->start ? now - profile->start : 0;
+    uint64_t base = profile->start;
+
+    if(profile->loop)
+    {
+        base += elapsed / profile->period * profile->period;
+        elapsed %= profile->period;
+    }
+
+    // last point at or before the current time
+    int i = 0;
+    while(i + 1 < profile->count && profile->points[i + 1].offset <= elapsed) i++;
+
+    profile_point *point = &profile->points[i];
+    profile_point *next = i + 1 < profile->count ? &profile->points[i + 1] : NULL;
+    uint64_t next_offset = next ? next->offset : profile->period;
+
+    // a looping profile continues with its first point
+    if(next == NULL && profile->loop) next = &profile->points[0];
+
+    memcpy(delays, point->delays, sizeof(point->delays));
+    memcpy(from, point->delays, sizeof(point->delays));
+    memcpy(to, point->delays, sizeof(point->delays));
+
+    if(next == NULL) return 0;
+    if(elapsed < point->offset) return base + point->offset; // before the first point
+
+    if(point->mode == profile_ramp && next_offset > point->offset)
+    {
+        double t = (double)(elapsed - point->offset) / (next_offset - point->offset);
+        for(int d = 0; d < 4; d++) delays[d] = point->delays[d] + t * (next->delays[d] - point->delays[d]);
+        memcpy(to, next->delays, sizeof(next->delays));
+
+        uint64_t update = now + PROFILE_RAMP_INTERVAL;
+        return update < base + next_offset ? update : base + next_offset;
+    }
+
+    return base + next_offset;
+}
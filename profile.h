@@ -0,0 +1,39 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+// delay ranges that change over time, executed by the daemon itself
+// every point sets the four delays at a time offset from the start and says how to get to the next point:
+// step keeps the delays until the next point, ramp moves them there linearly
+typedef enum
+{
+    profile_step,
+    profile_ramp
+} profile_mode;
+
+typedef struct
+{
+    uint64_t offset;            // nanoseconds after the start of the profile
+    double delays[4];           // min/max key delay and min/max move delay in milliseconds
+    profile_mode mode;
+} profile_point;
+
+typedef struct
+{
+    profile_point *points;      // sorted by offset
+    int count;
+    int loop;                   // start over after period
+    uint64_t period;
+    uint64_t start;             // time the profile was started on CLOCK_MONOTONIC in nanoseconds
+} delay_profile;
+
+// ramps are applied in steps of this length
+// a step only blends the tables built for both ends of the ramp, see blend_delay_tables
+#define PROFILE_RAMP_INTERVAL 10000000ULL   // nanoseconds
+
+delay_profile* load_profile(const char *path);
+void free_profile(delay_profile *profile);
+uint64_t evaluate_profile(delay_profile *profile, uint64_t now, double *delays, double *from, double *to);
+
+#endif
@@ -0,0 +1,134 @@
+#include "random.h"
+#include <math.h>
+#include <time.h>
+#include <sys/random.h>
+
+// https://prng.di.unimi.it/
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// splitmix64 is used to expand a single seed value into the full generator state
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void seed_rng(rng_state *rng, uint64_t seed)
+{
+    for(int i = 0; i < 4; i++) rng->s[i] = splitmix64(&seed);
+}
+
+// get a seed from the kernel, fall back to the current time if that fails
+uint64_t random_seed()
+{
+    uint64_t seed;
+    if(getrandom(&seed, sizeof(seed), 0) == sizeof(seed)) return seed;
+
+    return (uint64_t)time(NULL);
+}
+
+uint64_t rng_next(rng_state *rng)
+{
+    uint64_t *s = rng->s;
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+double normal_cdf(double x)
+{
+    return 0.5 * erfc(-x / M_SQRT2);
+}
+
+// inverse of the standard normal cdf
+// rational approximation by Peter Acklam, refined with one step of Halley's method
+double normal_quantile(double p)
+{
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    const double low = 0.02425;
+    double q, r, x;
+
+    if(p <= 0) return -INFINITY;
+    if(p >= 1) return INFINITY;
+
+    if(p < low)
+    {
+        q = sqrt(-2 * log(p));
+        x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+            ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+    else if(p <= 1 - low)
+    {
+        q = p - 0.5;
+        r = q * q;
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+            (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+    }
+    else
+    {
+        q = sqrt(-2 * log(1 - p));
+        x = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+             ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+
+    double e = normal_cdf(x) - p;
+    double u = e * sqrt(2 * M_PI) * exp(x * x / 2);
+    return x - u / (1 + x * u / 2);
+}
+
+void init_truncated_normal(truncated_normal *t, double mu, double sigma, double lower, double upper)
+{
+    t->mu = mu;
+    t->sigma = sigma > 0 ? sigma : 1e-9;
+    t->lower = (lower - mu) / t->sigma;
+    t->upper = (upper - mu) / t->sigma;
+
+    // the cdf is much more precise close to 0 than close to 1
+    t->flipped = t->lower > 0;
+    if(t->flipped)
+    {
+        double lower = -t->upper;
+        t->upper = -t->lower;
+        t->lower = lower;
+    }
+
+    t->cdf_lower = normal_cdf(t->lower);
+    t->cdf_upper = normal_cdf(t->upper);
+}
+
+// value below which a fraction p of the truncated distribution lies
+double truncated_normal_quantile(truncated_normal *t, double p)
+{
+    if(t->flipped) p = 1 - p;
+
+    // far out in a tail both cdfs underflow to 0, all of the probability is then at the bound closer to the mean
+    double x = t->cdf_upper > t->cdf_lower ? normal_quantile(t->cdf_lower + p * (t->cdf_upper - t->cdf_lower)) : t->upper;
+
+    // rounding can push the value slightly out of range
+    if(x < t->lower) x = t->lower;
+    if(x >= t->upper) x = nextafter(t->upper, t->lower);
+
+    if(t->flipped) x = -x;
+
+    return t->mu + t->sigma * x;
+}
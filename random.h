@@ -0,0 +1,35 @@
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include <stdint.h>
+
+// state of a xoshiro256** generator
+// every thread drawing random numbers owns its own state, so no locking is needed
+typedef struct
+{
+    uint64_t s[4];
+} rng_state;
+
+// normal distribution truncated to [lower, upper)
+// everything that doesn't depend on the random value is computed once when the parameters are set
+typedef struct
+{
+    double mu;
+    double sigma;
+    double lower;               // bounds of the standardized distribution
+    double upper;
+    double cdf_lower;           // cumulative probability at the bounds
+    double cdf_upper;
+    int flipped;                // bounds in the upper tail are mirrored to the lower tail for precision
+} truncated_normal;
+
+void seed_rng(rng_state *rng, uint64_t seed);
+uint64_t random_seed();
+uint64_t rng_next(rng_state *rng);
+
+double normal_cdf(double x);
+double normal_quantile(double p);
+void init_truncated_normal(truncated_normal *t, double mu, double sigma, double lower, double upper);
+double truncated_normal_quantile(truncated_normal *t, double p);
+
+#endif
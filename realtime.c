@@ -0,0 +1,55 @@
+#define _GNU_SOURCE // CPU_SET, pthread_setaffinity_np
+#include "realtime.h"
+#include <sched.h>
+#include <malloc.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PREFAULT_STACK_SIZE (512 * 1024)
+
+// run the calling thread with SCHED_FIFO at the given priority (1-99)
+// threads created before are not affected, so the log writer keeps running at normal priority
+int set_realtime_priority(int priority)
+{
+    struct sched_param param = {0};
+    param.sched_priority = priority;
+
+    errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    return errno == 0;
+}
+
+// restrict a thread to a single CPU
+int pin_thread(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    errno = pthread_setaffinity_np(thread, sizeof(set), &set);
+    return errno == 0;
+}
+
+// touch the stack the event loop will need so growing it never causes a page fault later
+static void prefault_stack()
+{
+    char stack[PREFAULT_STACK_SIZE];
+    volatile char *touch = stack;
+    long page = sysconf(_SC_PAGESIZE);
+
+    for(long i = 0; i < PREFAULT_STACK_SIZE; i += page) touch[i] = 0;
+}
+
+// lock everything that is mapped now and in the future into memory
+// allocations made up front (event pool, log ring, delay tables) are faulted in by mlockall itself
+int lock_memory()
+{
+    // keep freed memory instead of returning it to the system and don't serve allocations with fresh mappings
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) return 0;
+
+    prefault_stack();
+    return 1;
+}
@@ -0,0 +1,13 @@
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <pthread.h>
+
+// helpers to keep the event loop from being preempted or paged out under load
+// all of them return 1 on success and 0 on failure with errno set
+
+int set_realtime_priority(int priority);
+int pin_thread(pthread_t thread, int cpu);
+int lock_memory();
+
+#endif
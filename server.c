@@ -0,0 +1,64 @@
+#define _GNU_SOURCE // accept4
+#include "server.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// create the listening control socket, an old socket file at the same path is replaced
+// returns -1 on failure
+int open_server(const char *path)
+{
+    struct sockaddr_un address = {0};
+
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+
+    unlink(path);
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 16) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// accept the next waiting client, returns -1 if there is none
+int accept_client(int server_fd)
+{
+    return accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+// read the next command of a client
+// returns its length, 0 if the client disconnected and -1 if there is no command waiting
+ssize_t receive_message(int fd, char *buffer, size_t size)
+{
+    ssize_t length = recv(fd, buffer, size, 0);
+
+    if(length < 0 && errno != EAGAIN && errno != EINTR) return 0;
+    return length;
+}
+
+// replies are never waited for, a client that doesn't read them loses them
+void send_reply(int fd, const void *reply, size_t length)
+{
+    send(fd, reply, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+void close_server(int server_fd, const char *path)
+{
+    if(server_fd < 0) return;
+
+    close(server_fd);
+    unlink(path);
+}
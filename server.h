@@ -0,0 +1,78 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include "control.h"
+
+// control socket (SOCK_SEQPACKET), every message is one command and gets exactly one reply
+// clients can send several commands without waiting, replies come back in the same order
+//
+// text commands are plain ASCII (see README), replies start with "ok" or "error"
+// binary commands start with a command_header holding a known command, text that happens to start with a control
+// character (tab, newline) is still text, as its first four bytes never form one of these small numbers
+// binary replies start with a reply_header followed by length bytes of payload
+// all binary fields are stored in native byte order
+#define SERVER_MESSAGE_SIZE 512
+
+enum
+{
+    command_set_config = 1,     // payload: control_config
+    command_get_config,         // reply payload: control_config
+    command_get_stats,          // reply payload: server_stats
+    command_pause,
+    command_resume,
+    command_reload_policies,    // reload the delay policies from their file
+    command_limit               // one past the last command
+};
+
+enum
+{
+    status_ok,
+    status_unknown_command,
+    status_bad_arguments
+};
+
+typedef struct
+{
+    uint32_t command;
+    uint32_t reserved;
+} command_header;
+
+typedef struct
+{
+    uint32_t status;
+    uint32_t length;
+} reply_header;
+
+typedef struct
+{
+    uint64_t emitted;           // events emitted so far
+    uint64_t pending;           // events waiting for their deadline
+    uint64_t dropped;           // events dropped or passed on without delay because the pool was exhausted
+    uint64_t bypassed;
+    uint32_t paused;
+    uint32_t reserved;
+    uint64_t error_p99[4];      // emit error of key, rel, abs and other events in nanoseconds
+    uint64_t error_max[4];
+} server_stats;
+
+int open_server(const char *path);
+int accept_client(int server_fd);
+ssize_t receive_message(int fd, char *buffer, size_t size);
+void send_reply(int fd, const void *reply, size_t length);
+void close_server(int server_fd, const char *path);
+
+// a message is a binary command if it starts with a header holding a known command
+static inline int is_binary_command(const char *message, size_t length)
+{
+    command_header header;
+    if(length < sizeof(command_header)) return 0;
+
+    memcpy(&header, message, sizeof(command_header));
+    return header.command >= command_set_config && header.command < command_limit;
+}
+
+#endif
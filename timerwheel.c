@@ -0,0 +1,172 @@
+#include "timerwheel.h"
+
+// slots are kept sorted by sequence number, so events with the same expiry tick leave the wheel in the order they were added
+// new events always go to the tail, only cascaded events may have to be merged in front of events added after them
+static void append_to_slot(timer_wheel *w, int level, int index, delayed_event *event)
+{
+    wheel_slot *slot = &w->slots[level][index];
+
+    if(slot->tail == NULL || slot->tail->sequence < event->sequence)
+    {
+        event->next = NULL;
+        if(slot->tail) slot->tail->next = event;
+        else slot->head = event;
+        slot->tail = event;
+    }
+    else
+    {
+        delayed_event **link = &slot->head;
+        while((*link)->sequence < event->sequence) link = &(*link)->next;
+
+        event->next = *link;
+        *link = event;
+    }
+
+    w->occupied[level] |= 1ULL << index;
+}
+
+static delayed_event* take_slot(timer_wheel *w, int level, int index)
+{
+    wheel_slot *slot = &w->slots[level][index];
+    delayed_event *list = slot->head;
+
+    slot->head = slot->tail = NULL;
+    w->occupied[level] &= ~(1ULL << index);
+
+    return list;
+}
+
+// put an event into the slot matching its expiry tick relative to the current tick
+static void place_event(timer_wheel *w, delayed_event *event)
+{
+    // round up so an event is never emitted before it is due
+    uint64_t expires = (event->due + w->granularity - 1) / w->granularity;
+    if(expires < w->tick) expires = w->tick;
+
+    uint64_t delta = expires - w->tick;
+    int level = 0;
+
+    while(level < WHEEL_LEVELS - 1 && delta >= 1ULL << (WHEEL_BITS * (level + 1))) level++;
+
+    // clamp events beyond the range of the wheel, they are placed again when their slot is cascaded
+    if(delta >= 1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+    {
+        expires = w->tick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    append_to_slot(w, level, (expires >> (WHEEL_BITS * level)) & WHEEL_MASK, event);
+}
+
+// move all events of a higher level slot down to the levels below
+// returns the index of the cascaded slot so the caller knows whether the next level has to be cascaded as well
+static int cascade(timer_wheel *w, int level)
+{
+    int index = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    delayed_event *event = take_slot(w, level, index);
+
+    while(event)
+    {
+        delayed_event *next = event->next;
+        place_event(w, event);
+        event = next;
+    }
+
+    return index;
+}
+
+void init_wheel(timer_wheel *w, uint64_t granularity, uint64_t now)
+{
+    memset(w, 0, sizeof(timer_wheel));
+    w->granularity = granularity;
+    w->tick = now / granularity;
+}
+
+void add_to_wheel(timer_wheel *w, delayed_event *event)
+{
+    event->sequence = w->sequence++;
+    place_event(w, event);
+    w->used++;
+}
+
+// collect all events that are due at the given time
+// returns a linked list of the expired events in the order they are due
+delayed_event* expire_wheel(timer_wheel *w, uint64_t now)
+{
+    uint64_t target = now / w->granularity;
+    delayed_event *head = NULL;
+    delayed_event *tail = NULL;
+
+    if(w->used == 0)
+    {
+        if(w->tick <= target) w->tick = target + 1;
+        return NULL;
+    }
+
+    while(w->tick <= target)
+    {
+        int index = w->tick & WHEEL_MASK;
+
+        // skip ahead to the next cascade if there is nothing to do on the first level
+        if(index != 0 && w->occupied[0] == 0)
+        {
+            uint64_t next = (w->tick | WHEEL_MASK) + 1;
+            w->tick = next <= target ? next : target + 1;
+            continue;
+        }
+
+        if(index == 0)
+        {
+            for(int level = 1; level < WHEEL_LEVELS; level++)
+            {
+                if(cascade(w, level) != 0) break;
+            }
+        }
+
+        delayed_event *list = take_slot(w, 0, index);
+        w->tick++;
+
+        if(list == NULL) continue;
+
+        if(tail) tail->next = list;
+        else head = list;
+
+        tail = list;
+        w->used--;
+        while(tail->next)
+        {
+            tail = tail->next;
+            w->used--;
+        }
+    }
+
+    return head;
+}
+
+// find the earliest time at which the wheel has to be expired again
+// returns 0 if there are no pending events
+int next_wheel_deadline(timer_wheel *w, uint64_t *deadline)
+{
+    if(w->used == 0) return 0;
+
+    uint64_t best = UINT64_MAX;
+
+    for(int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        uint64_t occupied = w->occupied[level];
+        if(occupied == 0) continue;
+
+        int shift = WHEEL_BITS * level;
+        uint64_t current = w->tick >> shift;
+
+        // the current slot is still pending unless it has already been cascaded on this rotation
+        int start = (w->tick & ((1ULL << shift) - 1)) == 0 ? 0 : 1;
+        int offset = (current + start) & WHEEL_MASK;
+        uint64_t rotated = (occupied >> offset) | (offset ? occupied << (WHEEL_SLOTS - offset) : 0);
+        uint64_t tick = (current + start + __builtin_ctzll(rotated)) << shift;
+
+        if(tick < best) best = tick;
+    }
+
+    *deadline = best * w->granularity;
+    return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include "log.h"
+
+#define WHEEL_LEVELS 5
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+typedef struct
+{
+    delayed_event* head;
+    delayed_event* tail;
+} wheel_slot;
+
+// hierarchical timing wheel for pending events
+// level 0 holds events due within the next 64 ticks, every further level covers 64 times the range of the previous one
+// with the default granularity of 10 us this covers 2^30 ticks, delays of up to ~3 hours
+// longer events are clamped to the last slot of the top level and placed again each time that slot is cascaded
+typedef struct
+{
+    uint64_t granularity;       // length of one tick in nanoseconds
+    uint64_t tick;              // next tick to be expired
+    size_t used;                // number of pending events
+    uint64_t sequence;          // number of events added so far, keeps events with the same expiry tick in order
+    uint64_t occupied[WHEEL_LEVELS];    // bitmap of non-empty slots for each level
+    wheel_slot slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} timer_wheel;
+
+void init_wheel(timer_wheel *w, uint64_t granularity, uint64_t now);
+void add_to_wheel(timer_wheel *w, delayed_event *event);
+delayed_event* expire_wheel(timer_wheel *w, uint64_t now);
+int next_wheel_deadline(timer_wheel *w, uint64_t *deadline);
+
+#endif
@@ -0,0 +1,183 @@
+#include "trace.h"
+#include "log.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <linux/input.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void add_delay(delay_trace *trace, size_t *capacity, uint64_t delay)
+{
+    if(trace->count == *capacity)
+    {
+        *capacity *= 2;
+        trace->values = realloc(trace->values, *capacity * sizeof(uint64_t));
+    }
+    trace->values[trace->count++] = delay;
+}
+
+// collect the delays of an event log segment written by DelayDaemon
+// the log has one record per event, consecutive records with the same timestamp form a frame that had a single delay
+// a frame counts as key frame if any of its events is a key or button event, like when it was delayed
+static int read_event_log(delay_trace *trace, size_t *capacity, const void *data, size_t size, trace_class class)
+{
+    const log_header *header = data;
+
+    if(le16toh(header->version) != LOG_VERSION || le16toh(header->record_size) != sizeof(log_record)) return 0;
+
+    size_t count = (size - sizeof(log_header)) / sizeof(log_record);
+    if(le64toh(header->record_count) < count) count = le64toh(header->record_count);
+
+    const log_record *records = (const log_record*)(header + 1);
+    size_t i = 0;
+
+    while(i < count)
+    {
+        int64_t timestamp = le64toh(records[i].timestamp);
+        uint64_t delay = le64toh(records[i].delay);
+        int is_key = 0;
+
+        for(; i < count && (int64_t)le64toh(records[i].timestamp) == timestamp; i++)
+        {
+            if(le16toh(records[i].type) == EV_KEY) is_key = 1;
+        }
+
+        if(is_key == (class == trace_keys)) add_delay(trace, capacity, delay);
+    }
+
+    return trace->count > 0;
+}
+
+// copy field number column (counted from 0, separated by ';' or ',') of the line, returns 0 if the line has no such field
+static int read_field(const char *line, const char *end, int column, char *field, size_t size)
+{
+    int i = 0;
+    for(; i < column && line < end && *line != '\n'; line++)
+    {
+        if(*line == ';' || *line == ',') i++;
+    }
+    if(i < column) return 0;
+
+    size_t length = 0;
+    while(line + length < end && length < size - 1 && line[length] != ';' && line[length] != ',' && line[length] != '\n') length++;
+    memcpy(field, line, length);
+    field[length] = '\0';
+
+    return 1;
+}
+
+// read the delay column of a CSV event log (timestamp;delay;type;value;code) or a list with one delay per line
+// delays are given in (fractional) milliseconds and converted to nanoseconds once
+// CSV logs are split into frames and classes like binary logs, plain lists are replayed as they are for both classes
+static int parse_delay_list(delay_trace *trace, size_t *capacity, const char *data, size_t size, trace_class class)
+{
+    int delay_column = 0, timestamp_column = -1, type_column = -1;
+    const char *line = data;
+    const char *end = data + size;
+
+    // the header tells which columns hold the delays, timestamps and event types
+    if(size > 0 && (line[0] < '0' || line[0] > '9'))
+    {
+        int column = 0;
+        for(const char *name = line; name < end && *name != '\n'; name++)
+        {
+            if(name == line || name[-1] == ';' || name[-1] == ',')
+            {
+                if(strncmp(name, "delay", 5) == 0) delay_column = column;
+                if(strncmp(name, "timestamp", 9) == 0) timestamp_column = column;
+                if(strncmp(name, "type", 4) == 0) type_column = column;
+            }
+            if(*name == ';' || *name == ',') column++;
+        }
+        line = memchr(line, '\n', end - line);
+        line = line ? line + 1 : end;
+    }
+
+    int frames = timestamp_column >= 0 && type_column >= 0;
+    char timestamp[32] = "", frame_timestamp[32] = "";
+    double frame_delay = -1;
+    int frame_key = 0;
+
+    while(line < end)
+    {
+        char number[32], type[32];
+        char *parsed;
+
+        double delay = read_field(line, end, delay_column, number, sizeof(number)) ? strtod(number, &parsed) : -1;
+        int valid = delay >= 0 && parsed != number;
+
+        if(valid && !frames) add_delay(trace, capacity, (uint64_t)(delay * 1000000 + 0.5));
+        else if(valid)
+        {
+            read_field(line, end, timestamp_column, timestamp, sizeof(timestamp));
+
+            // a new timestamp ends the previous frame
+            if(strcmp(timestamp, frame_timestamp) != 0)
+            {
+                if(frame_delay >= 0 && frame_key == (class == trace_keys)) add_delay(trace, capacity, (uint64_t)(frame_delay * 1000000 + 0.5));
+                strcpy(frame_timestamp, timestamp);
+                frame_delay = delay;
+                frame_key = 0;
+            }
+            if(read_field(line, end, type_column, type, sizeof(type)) && atoi(type) == EV_KEY) frame_key = 1;
+        }
+
+        line = memchr(line, '\n', end - line);
+        line = line ? line + 1 : end;
+    }
+
+    if(frame_delay >= 0 && frame_key == (class == trace_keys)) add_delay(trace, capacity, (uint64_t)(frame_delay * 1000000 + 0.5));
+
+    return trace->count > 0;
+}
+
+// load the delays of one class of frames from a binary event log segment or a CSV/text file
+// returns NULL if the file can't be read or contains no delays for this class
+delay_trace* load_trace(const char *path, trace_class class)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return NULL;
+
+    delay_trace *trace = calloc(1, sizeof(delay_trace));
+    size_t capacity = 1024;
+    int loaded;
+
+    trace->values = malloc(capacity * sizeof(uint64_t));
+
+    if((size_t)st.st_size >= sizeof(log_header) && memcmp(data, LOG_MAGIC, 4) == 0)
+    {
+        loaded = read_event_log(trace, &capacity, data, st.st_size, class);
+    }
+    else loaded = parse_delay_list(trace, &capacity, data, st.st_size, class);
+
+    munmap(data, st.st_size);
+
+    if(!loaded)
+    {
+        free_trace(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+void free_trace(delay_trace *trace)
+{
+    if(trace == NULL) return;
+
+    free(trace->values);
+    free(trace);
+}
@@ -0,0 +1,35 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// recorded sequence of delays that is replayed in order, wrapping around at the end
+// the delays are read into an array once, nothing is parsed while replaying
+typedef struct
+{
+    uint64_t *values;           // delays in nanoseconds, one per frame
+    size_t count;
+    size_t cursor;              // next value to replay
+} delay_trace;
+
+// which frames of an event log are replayed, the daemon draws key and move delays separately
+typedef enum
+{
+    trace_keys,                 // frames containing a key or button event
+    trace_moves                 // all other frames
+} trace_class;
+
+delay_trace* load_trace(const char *path, trace_class class);
+void free_trace(delay_trace *trace);
+
+// next delay of the trace in nanoseconds
+static inline uint64_t next_trace_value(delay_trace *trace)
+{
+    uint64_t value = trace->values[trace->cursor];
+    if(++trace->cursor == trace->count) trace->cursor = 0;
+
+    return value;
+}
+
+#endif
@@ -0,0 +1,83 @@
+// compares the timer wheel against a binary heap as pending event queue
+// events get random delays between 0 and 500 ms, then simulated time advances in 0.1 ms steps until all are expired
+
+#include "heap.h"
+#include "timerwheel.h"
+#include "timing.h"
+
+#define MAX_DELAY (500 * NSEC_PER_MSEC)
+#define STEP (100000ULL)
+
+static void fill_events(delayed_event *events, int count, uint64_t base)
+{
+    for(int i = 0; i < count; i++)
+    {
+        events[i].due = base + ((uint64_t)rand() * RAND_MAX + rand()) % MAX_DELAY;
+    }
+}
+
+static void bench_heap(delayed_event *events, int count, uint64_t base)
+{
+    event_heap h;
+    init_heap(&h, 64);
+
+    uint64_t start = now_ns();
+    for(int i = 0; i < count; i++) push_heap(&h, &events[i]);
+    uint64_t inserted = now_ns();
+
+    int expired = 0;
+    for(uint64_t now = base; expired < count; now += STEP)
+    {
+        while(peek_heap(&h) && peek_heap(&h)->due <= now)
+        {
+            pop_heap(&h);
+            expired++;
+        }
+    }
+    uint64_t end = now_ns();
+
+    printf("heap  %7d events: insert %6.1f ns/event, expire %6.1f ns/event\n", count,
+            (double)(inserted - start) / count, (double)(end - inserted) / count);
+    free_heap(&h);
+}
+
+static void bench_wheel(delayed_event *events, int count, uint64_t base)
+{
+    static timer_wheel w;
+    init_wheel(&w, STEP, base);
+
+    uint64_t start = now_ns();
+    for(int i = 0; i < count; i++) add_to_wheel(&w, &events[i]);
+    uint64_t inserted = now_ns();
+
+    int expired = 0;
+    for(uint64_t now = base; expired < count; now += STEP)
+    {
+        for(delayed_event *event = expire_wheel(&w, now); event; event = event->next) expired++;
+    }
+    uint64_t end = now_ns();
+
+    printf("wheel %7d events: insert %6.1f ns/event, expire %6.1f ns/event\n", count,
+            (double)(inserted - start) / count, (double)(end - inserted) / count);
+}
+
+int main(int argc, char* argv[])
+{
+    int counts[] = {1000, 10000, 100000};
+    uint64_t base = 1000 * NSEC_PER_SEC;
+
+    srand(42);
+
+    for(int i = 0; i < 3; i++)
+    {
+        delayed_event *events = malloc(counts[i] * sizeof(delayed_event));
+
+        fill_events(events, counts[i], base);
+        bench_heap(events, counts[i], base);
+        bench_wheel(events, counts[i], base);
+
+        free(events);
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// checks that the timer wheel emits events in the order the daemon relies on
+// frames with the same deadline must leave in the order they were added, even if one of them was cascaded
+
+#include <stdio.h>
+#include "timerwheel.h"
+
+#define STEP 10000ULL
+
+static int failures = 0;
+
+static void expect_order(const char *name, delayed_event *list, delayed_event **expected, int count)
+{
+    int i = 0;
+    for(delayed_event *event = list; event; event = event->next, i++)
+    {
+        if(i >= count || event != expected[i]) break;
+    }
+
+    if(i != count)
+    {
+        printf("FAIL %s\n", name);
+        failures++;
+    }
+    else printf("ok   %s\n", name);
+}
+
+// A is added at tick 0 and due at tick 100, so it goes to level 1
+// B is added at tick 40 and due at tick 100 as well, so it goes straight to level 0
+// A is cascaded into B's slot at tick 64 and must still come first
+static void test_cascade_order()
+{
+    static timer_wheel w;
+    delayed_event a = {0}, b = {0};
+
+    init_wheel(&w, STEP, 0);
+    a.due = 100 * STEP;
+    add_to_wheel(&w, &a);
+
+    expire_wheel(&w, 40 * STEP);
+    b.due = 100 * STEP;
+    add_to_wheel(&w, &b);
+
+    delayed_event *expected[] = {&a, &b};
+    expect_order("cascaded event keeps its place", expire_wheel(&w, 100 * STEP), expected, 2);
+}
+
+// events with the same deadline spread over several cascades leave in insertion order
+static void test_mixed_levels()
+{
+    static timer_wheel w;
+    static delayed_event events[8];
+    delayed_event *expected[8];
+
+    init_wheel(&w, STEP, 0);
+    for(int i = 0; i < 8; i++)
+    {
+        expire_wheel(&w, (uint64_t)i * 1000 * STEP);
+        events[i].due = 8192 * STEP;
+        add_to_wheel(&w, &events[i]);
+        expected[i] = &events[i];
+    }
+
+    expect_order("same deadline across levels", expire_wheel(&w, 8192 * STEP), expected, 8);
+}
+
+int main()
+{
+    test_cascade_order();
+    test_mixed_levels();
+
+    return failures ? 1 : 0;
+}